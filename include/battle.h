@@ -9,11 +9,20 @@
 #define NUM_SHIPS (5)
 #define NUM_SHIP_PARTS (17)
 #define MESSAGE_SIZE_MAX (40)
+#define NAME_SIZE (16)  // including terminating '\0'
+
+// Size of a fleet message (board followed by ship map)
+#define FLEET_MESSAGE_SIZE (BOARD_SIZE * sizeof(char) + BOARD_SIZE * sizeof(int))
 
 // Player modes
 enum MODE {
 	HOST = 'h',
-	JOIN = 'j'
+	JOIN = 'j',
+	HUB = 'f',    // hosts a free-for-all game
+	PLAYER = 'p', // joins a free-for-all game
+	SERVER = 's', // pairs joining players and relays their games
+	LEADERBOARD = 'l',
+	TOURNAMENT = 't' // plays external engines against each other or the bot
 };
 
 // Colors used for symbols
@@ -62,9 +71,17 @@ extern struct ship_t player_ships[NUM_SHIPS];
 extern struct ship_t opponent_ships[NUM_SHIPS];
 
 // PRE: Checks if input is valid by comparing against expected value
+//      (INPUT_END and INPUT_TIMEOUT count as valid, there is nothing to
+//      retry)
 // POST: -
 int is_valid_input(const int, const int);
 
+// PRE: Coordinates to read
+// POST: Row and column entered by player (one-based); returns 0,
+//       INPUT_END or INPUT_TIMEOUT if the input ended or the deadline
+//       passed first
+int read_coords(int *, int *);
+
 // PRE: Print a character in a certain color to console
 // POST: -
 void print_char_col(const char, const unsigned int);
@@ -99,11 +116,26 @@ int is_inside(const int, const int);
 int is_overlap(const char *, const int, 
                      const int, const int, enum ORIENTATIONS);
 
+// PRE: Apply shot at zero-based board index without any output
+// POST: -1 if index was invalid or already shot, 0 if MISS, 1 if HIT;
+//       sunk_id set to id of destroyed ship, -1 otherwise
+int apply_shot(const int, char *, const int *, int *, 
+               struct ship_t *, int *);
+
 // PRE: Shoot opponent board at given coordinates
-// POST: 1 if target coordinates were invalid, 0 if ok
+// POST: -1 if target coordinates were invalid, 0 if MISS 1 if HIT
 int shoot(const int, const int, char *, const int *, int *, 
           struct ship_t *, enum PLAYER);
 
+// PRE: Board and ship map received from another player
+// POST: 1 if every ship lies fully inside the board as one straight,
+//       contiguous segment of its length, 0 otherwise
+int is_valid_fleet(const char *, const int *);
+
+// PRE: Ship map and id of a ship placed on it
+// POST: Zero-based origin (top-left most part) and orientation of the ship
+void locate_ship(const int *, const int, int *, int *, enum ORIENTATIONS *);
+
 // PRE: Draws board to console
 // POST: -
 void draw_board(const char *);
@@ -113,11 +145,22 @@ void draw_board(const char *);
 void draw_board_side_by_side(const char *, const char *, enum STATE);
 
 // PRE: Place all ships within board given player input
-// POST: -
-void place_ship(const struct ship_t *, char *, int *, const int);
+// POST: Returns 0, INPUT_END or INPUT_TIMEOUT if the input ended or the
+//       deadline passed before the ship was placed
+int place_ship(const struct ship_t *, char *, int *, const int);
 
 // PRE: Based on user input, place all ships in board
-// POST: -
-void place_all_ships(char *, int *);
+// POST: Returns 0, INPUT_END or INPUT_TIMEOUT if the input ended or the
+//       deadline passed and the ships left were placed at random
+int place_all_ships(char *, int *);
+
+// PRE: Empty board and ship map, state of the caller's random generator
+// POST: All ships placed at random, legal positions
+void place_random_ships(char *, int *, unsigned int *);
+
+// PRE: Board and ship map holding the ships before the first one given,
+//      state of the caller's random generator
+// POST: That ship and all after it placed at random, legal positions
+void place_remaining_ships(char *, int *, const int, unsigned int *);
 
 #endif /* BATTLE_H */
@@ -0,0 +1,83 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "battle.h"
+
+// Bot parameters
+#define BOT_HIT_WEIGHT (100)             // placements through hits are preferred
+#define BOT_CACHE_ENTRIES (1 << 20)      // must be a power of two
+#define BOT_CACHE_MAGIC (0x43544f42u)    // "BOTC"
+#define BOT_CACHE_VERSION (1)
+#define BOT_CACHE_ENV "BATTLE_BOT_CACHE" // file to warm start from
+
+// What the bot knows about a cell of the opponent board
+enum CELL {
+	CELL_UNKNOWN,
+	CELL_MISS,
+	CELL_HIT,
+	CELL_SUNK,  // part of a destroyed ship
+	NUM_CELLS
+};
+
+// Observed state of the opponent board; the hash covers exactly the cells
+// and sunk ships, so equal states get equal hashes in every game
+struct bot {
+	unsigned char cells[BOARD_SIZE];
+	int sunk[NUM_SHIPS];
+	uint64_t hash;
+	// Cache use of this bot only, so counting costs no sharing
+	uint64_t lookups;
+	uint64_t cache_hits;
+};
+
+// Entry of the shared cache; stores hash ^ move next to the move, so torn
+// writes of racing threads are detected instead of locked out
+struct bot_cache_entry {
+	_Atomic uint64_t check;
+	_Atomic uint64_t move;
+};
+
+// Start of the cache file
+struct bot_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t entries;
+};
+
+// PRE: Path of a cache file to warm start from, NULL for a cold cache
+// POST: Shared cache of decisions allocated (and loaded if the file is
+//       valid); returns 0 on success, 1 otherwise
+int bot_cache_init(const char *);
+
+// PRE: Initialized cache and path of cache file
+// POST: Cache written to file; returns 0 on success, 1 otherwise
+int bot_cache_save(const char *);
+
+// PRE: Cache nobody uses anymore
+// POST: Memory released; bots compute every decision again
+void bot_cache_destroy(void);
+
+// PRE: Bot
+// POST: Bot knows nothing about the opponent board (start of a game)
+void bot_reset(struct bot *);
+
+// PRE: Bot, board index shot, whether it hit, id of the ship it destroyed
+//      (-1 if none) and the opponent's ship map, which reveals the cells of
+//      destroyed ships only
+// POST: Observed state and its hash updated incrementally
+void bot_observe(struct bot *, const int, const int, const int, const int *);
+
+// PRE: Bot, opponent board as drawn, ship map and ships
+// POST: Bot knows what the player has seen of that board: hits, misses and
+//       cells of destroyed ships
+void bot_observe_board(struct bot *, const char *, const int *, const struct ship_t *);
+
+// PRE: Bot with at least one unknown cell
+// POST: Board index to shoot next, taken from the cache if this state was
+//       decided before, by ship density otherwise
+int bot_choose(struct bot *);
+
+#endif /* BOT_H */
@@ -0,0 +1,10 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+// PRE: -
+// POST: Monotonic time in nanoseconds
+uint64_t now_ns(void);
+
+#endif /* CLOCK_H */
@@ -11,6 +11,22 @@
 #include <limits.h>
 #include <assert.h>
 
+#include "session.h"
+
+#define RESUME_TIMEOUT_S (60)  // time given to a dropped peer to come back
+#define TURN_LIMIT_S (30)       // time to shoot before the bot shoots instead
+#define GAME_LIMIT_S (300)      // time a player may take for all shots of a game
+#define PEER_GRACE_S (5)        // extra time for the opponent's shot to arrive
+#define PLACE_LIMIT_S (120)     // time to place ships before the rest is random
+#define REMATCH_LIMIT_S (30)    // time to answer the rematch question
+#define FORFEIT (-1)            // row and column of a shot that gives up
+
+// Message exchanged when resuming a game
+struct resume_msg {
+	int turn;           // last turn completed on this side
+	uint32_t checksum;  // identifies both fleets of the game
+};
+
 // PRE: Socket of peer and send buffer + length
 // POST: Blocks until all data has been successfully sent
 int send_full(const int, const void *, int);
@@ -23,6 +39,18 @@ int recv_full(const int, const void *, int);
 // POST: Returns ip address (string)
 int hostname_to_ip(const char *, char *);
 
+// PRE: Socket to listen on and number of pending connections allowed
+// POST: Returns 0 on success, error code otherwise
+int listen_players(int *, const int);
+
+// PRE: Listening socket
+// POST: Blocks until a player connected; returns 0 on success
+int accept_player(const int, int *);
+
+// PRE: IP address of host
+// POST: Connected to host; returns 0 on success, error code otherwise
+int join_host(const char *, int *);
+
 // PRE: Connects host (server) with joinee (client)
 // POST: Returns 0 on success, 1 otherwise
 int connect_players(int *, int *, enum MODE);
@@ -32,13 +60,30 @@ int connect_players(int *, int *, enum MODE);
 // POST: -
 int sendrecv(const int, const void *, const void *, int, enum MODE);
 
-// PRE: Exchange shots between player and opponent
-// POST: Returns 1 on error and 0 otherwise
-int exchange_shots(const int, int, 
-                   int *, char *, const int *, 
-                   struct ship_t *, int *, 
-                   int *, char *, const int *,
-                   struct ship_t *, int *,
-                   enum MODE mode);
+// PRE: Socket of peer and number of seconds
+// POST: Receiving from the peer fails after waiting that long
+void set_peer_timeout(const int, const int);
+
+// PRE: Exchange shots between player and opponent of session
+// POST: Both shots of a round exchanged, whichever comes first; a player
+//       too slow for TURN_LIMIT_S gets a shot by the bot, one out of game
+//       time forfeits, and an opponent not heard from in time forfeits
+//       and ends the session (closing); a shot typed only partly waits
+//       for the rest without holding up the round; returns 1 on error and
+//       0 otherwise
+int exchange_shots(const int, struct session *);
+
+// PRE: Listening socket (host only) after the connection to the peer was
+//      closed
+// POST: Same peer connected again within RESUME_TIMEOUT_S seconds;
+//       returns 0 on success, 1 otherwise
+int reconnect_players(const int, int *, enum MODE);
+
+// PRE: Session whose connection broke during the game, listening socket
+//      (host only)
+// POST: Peer reconnected, both sides agreed on the last turn they completed
+//       and the session was rolled back to it; returns 0 on success,
+//       1 otherwise
+int resume_game(const int, int *, struct session *, enum MODE);
 
 #endif /* COMMUNICATE_H */
@@ -0,0 +1,78 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Engine parameters
+#define ENGINE_PROTOCOL_VERSION (1)
+#define ENGINE_NAME_SIZE (32)
+#define ENGINE_BUFFER_SIZE (1 << 16)  // requests are written in chunks of this
+#define ENGINE_LINE_SIZE (256)
+#define ENGINE_TIMEOUT_S (10)         // time an engine has to take and answer a batch
+#define ENGINE_REAP_MS (10)           // how often a quitting engine is checked on
+#define ENGINE_SOCKET_PREFIX "unix:"  // engine listening on a Unix socket
+
+// Text protocol between the game (arbiter) and an external engine, one
+// message per line; an engine serves any number of games at once, told
+// apart by their ids:
+//
+//   arbiter -> engine                     engine -> arbiter
+//   battle <version>                      ready <name>
+//   new <game>                            fleet <game> (<o> <row> <col>) x 5
+//   shoot <game>                          shot <game> <row> <col>
+//   result <game> <row> <col> miss|hit
+//   result <game> <row> <col> sunk <ship> <o> <row> <col>
+//   end <game> win|loss|draw
+//   go                                    done
+//   quit
+//
+// Requests are batched: the arbiter sends new, shoot, result and end
+// messages for all its games, then go; the engine answers every new with
+// a fleet and every shoot with a shot, in any order, then done. Ships are
+// given in order of their ids like players place them (o is h or v, rows
+// and columns start at 1); sunk reveals where the destroyed ship lay.
+
+// Connection to an external engine
+struct engine {
+	char name[ENGINE_NAME_SIZE];
+	int fd_in;   // replies are read from here
+	int fd_out;  // requests are written here
+	pid_t pid;   // engine process started by us, -1 for a socket
+	char out[ENGINE_BUFFER_SIZE];
+	int out_len;
+	char in[ENGINE_BUFFER_SIZE];
+	int in_pos;
+	int in_len;
+	int failed;  // engine broke the protocol or is gone
+	int batch_open;  // requests of a batch queued, its done not read yet
+	uint64_t batch_start;  // first request of the batch queued
+	uint64_t busy_ns;  // time from first requests to done of all batches
+	int batches;
+};
+
+// PRE: Engine and either a command line to start it with or
+//      ENGINE_SOCKET_PREFIX followed by the path of its socket
+// POST: Engine started or connected and greeted; returns 0 on success,
+//       1 otherwise
+int engine_open(struct engine *, const char *);
+
+// PRE: Open engine, printf-style request without newline
+// POST: Request added to the current batch
+void engine_request(struct engine *, const char *, ...) __attribute__((format(printf, 2, 3)));
+
+// PRE: Open engine with a batch of requests
+// POST: Batch closed with go and written; returns 0 on success, 1 otherwise
+int engine_go(struct engine *);
+
+// PRE: Open engine after engine_go and buffer for a line
+// POST: Next reply of the batch read; returns 0 for a reply, 1 once the
+//       batch is done and -1 on error or after ENGINE_TIMEOUT_S
+int engine_reply(struct engine *, char *, const int);
+
+// PRE: Engine opened with engine_open (successfully or not)
+// POST: Engine told to quit, connection closed and process reaped; one
+//       still running after ENGINE_TIMEOUT_S is killed
+void engine_close(struct engine *);
+
+#endif /* ENGINE_H */
@@ -0,0 +1,35 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include "session.h"
+
+// Estimate parameters
+#define ESTIMATE_BUDGET_MS (50)       // time an estimate may take per turn
+#define ESTIMATE_THREADS_MAX (16)
+#define ESTIMATE_BATCH (64)           // playouts between checks of the precision
+#define ESTIMATE_MIN_PLAYOUTS (512)   // fewer are not shown
+#define ESTIMATE_PRECISION (0.005)    // stop once the standard error is below
+#define ESTIMATE_SAMPLE_TRIES (1000)  // attempts to find a consistent fleet
+
+// Chances of the player of a session, estimated by playing out the game
+struct win_estimate {
+	double win;
+	double draw;
+	double loss;
+	int playouts;
+	double elapsed_ms;
+};
+
+// PRE: Session of a running game (not changed while estimating)
+// POST: Chances estimated by sampling opponent fleets consistent with what
+//       the player has seen and playing both sides out with a hunt/target
+//       strategy on all cores, within ESTIMATE_BUDGET_MS; returns 0 on
+//       success, 1 if fewer than ESTIMATE_MIN_PLAYOUTS could be made in
+//       time (playouts and elapsed_ms are set either way)
+int estimate_win(const struct session *, struct win_estimate *);
+
+// PRE: Session of a running game
+// POST: Estimated chances of both players printed below the boards
+void print_win_estimate(const struct session *);
+
+#endif /* ESTIMATE_H */
@@ -0,0 +1,43 @@
+#ifndef HUB_H
+#define HUB_H
+
+#include "battle.h"
+
+// Free-for-all parameters
+#define FFA_PLAYERS_MIN (3)
+#define FFA_PLAYERS_MAX (16)
+#define HUB_QUEUE_SIZE (64)  // pending messages per player
+
+// Messages exchanged between hub and players
+enum HUB_MESSAGE {
+	MSG_WELCOME,     // hub -> player: target = your id, arg = number of players
+	MSG_TURN,        // hub -> all: shooter = player to move
+	MSG_SHOT,        // player -> hub: target, row, col
+	MSG_RESULT,      // hub -> all: shot taken, result = 0 MISS 1 HIT,
+	                 //             arg = id of destroyed ship or -1
+	MSG_INVALID,     // hub -> shooter: shot was rejected, try again
+	MSG_ELIMINATED,  // hub -> all: target has no ship parts left or left
+	MSG_GAMEOVER     // hub -> all: shooter = winner (-1 if nobody is left)
+};
+
+// Fixed-size message datatype (sent as is, like coordinates)
+struct hub_msg {
+	int type;
+	int shooter;
+	int target;
+	int row;
+	int col;
+	int result;
+	int arg;
+};
+
+// PRE: Listening socket and number of players in the game
+// POST: Accepts all players, runs the game until one fleet is left;
+//       returns 0 on success, 1 otherwise
+int run_hub(const int, const int);
+
+// PRE: Socket connected to a hub
+// POST: Plays a free-for-all game; returns 0 on success, 1 on error
+int play_free_for_all(const int);
+
+#endif /* HUB_H */
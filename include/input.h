@@ -0,0 +1,69 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "log.h"
+
+// Input parameters
+#define INPUT_BUFFER_SIZE (1 << 16)
+#define INPUT_TOKEN_SIZE (256)  // longer tokens are cut
+#define INPUT_END (-1)          // returned by reads once the input ended
+#define INPUT_TIMEOUT (-2)      // returned by reads once the deadline passed
+
+// PRE: Path of a script ("-" for standard input)
+// POST: All further input is read from the script in batch mode, which
+//       neither prompts nor renders; returns 0 on success, 1 otherwise
+int input_open_batch(const char *);
+
+// PRE: -
+// POST: 1 in batch mode, 0 otherwise
+int is_batch(void);
+
+// PRE: -
+// POST: Level of messages meant for the player, which batch mode hides
+//       unless debugging
+enum LOG_LEVEL chatter_level(void);
+
+// PRE: -
+// POST: File descriptor input is read from, to wait for it with poll
+int input_source(void);
+
+// PRE: Monotonic time (see now_ns) reads may wait for input until, 0 to
+//      wait as long as it takes
+// POST: Reads that would have to wait past it return INPUT_TIMEOUT and
+//       consume nothing; a deadline already passed only takes input that
+//       is there
+void input_set_deadline(const uint64_t);
+
+// PRE: -
+// POST: 1 if a token is already buffered (poll would not report it), 0
+//       otherwise, or if the last read timed out waiting for the rest
+int input_buffered(void);
+
+// PRE: printf-style format and arguments
+// POST: Printed unless in batch mode
+void prompt(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+// PRE: Array for number of integers to read
+// POST: Returns how many integers were read before a token could not be
+//       parsed (that token is left for input_skip), INPUT_END if the input
+//       ended first, INPUT_TIMEOUT if the deadline passed first
+int input_ints(int *, const int);
+
+// PRE: -
+// POST: First character of the next token; returns 1, INPUT_END at end of
+//       input, INPUT_TIMEOUT once the deadline passed
+int input_char(char *);
+
+// PRE: Buffer and its size
+// POST: Next token, cut to fit buffer; returns 1, INPUT_END at end of
+//       input, INPUT_TIMEOUT once the deadline passed
+int input_word(char *, const size_t);
+
+// PRE: -
+// POST: Next token discarded, unless it is not complete by the deadline
+void input_skip(void);
+
+#endif /* INPUT_H */
@@ -0,0 +1,68 @@
+#ifndef LOG_H
+#define LOG_H
+
+// Log parameters
+#define LOG_BUFFER_RECORDS (256)  // records kept per thread, a power of two
+#define LOG_MESSAGE_SIZE (256)    // longer messages are cut
+#define LOG_FIELDS_SIZE (128)
+#define LOG_OUTPUT_SIZE (1 << 16) // bytes the sink writes at once
+#define LOG_DRAIN_MS (10)         // how often the sink writes records out
+#define LOG_LEVEL_ENV "BATTLE_LOG_LEVEL"  // debug, info (default), warn, error
+#define LOG_FILE_ENV "BATTLE_LOG_FILE"    // logfmt file instead of the console
+
+// Records are queued in a buffer of the calling thread without locks and
+// written out by a background thread, so game code never waits for the
+// terminal or the disk:
+//     log_fields("row=%d col=%d", row, col);  // optional, for the next record
+//     log_write(LOG_INFO, "shot", "You shot: (%d, %d)", row, col);
+// On the console only the message is printed (warnings and errors to
+// stderr), on a line of its own even after a prompt; in BATTLE_LOG_FILE every record is a logfmt line with time,
+// level, process, thread, event, message and fields. Records of a thread
+// whose buffer is full are dropped and counted.
+//
+// The sink writes every LOG_DRAIN_MS, so a record can reach the console
+// after text the game printed since. Draining on the game thread costs a
+// lock and a write, so it only happens where the order is seen: before a
+// prompt and before a board is drawn (log_flush_console), and when the
+// process exits (log_flush). The wait for input or the opponent does not
+// drain; records queued during it appear within LOG_DRAIN_MS. A log file
+// is only ever written by the sink.
+enum LOG_LEVEL {
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_WARN,
+	LOG_ERROR,
+	NUM_LOG_LEVELS
+};
+
+// PRE: printf-style format of logfmt fields (key=value separated by spaces)
+// POST: Fields attached to the next record of the calling thread; ignored
+//       on the console
+void log_fields(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+// PRE: Level, static name of the event and printf-style message
+// POST: Record queued unless below BATTLE_LOG_LEVEL
+void log_write(const enum LOG_LEVEL, const char *, const char *, ...)
+	__attribute__((format(printf, 3, 4)));
+
+// PRE: Static name of the event and a message, after a call that set errno
+// POST: Error queued like perror prints it
+void log_errno(const char *, const char *);
+
+// PRE: Whether the console is in the middle of a line: 1 after a prompt,
+//      0 once its answer was read (the echo of which ended the line)
+// POST: The next record on the console starts on a new line if needed
+void log_midline(const int);
+
+// PRE: -
+// POST: Standard output flushed and every record queued so far written;
+//       call before exiting
+void log_flush(void);
+
+// PRE: -
+// POST: Records bound for the console written ahead of what the caller
+//       prints next; without any queued, or when logging to a file, nothing
+//       but standard output is flushed
+void log_flush_console(void);
+
+#endif /* LOG_H */
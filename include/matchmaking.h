@@ -0,0 +1,72 @@
+#ifndef MATCHMAKING_H
+#define MATCHMAKING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "session.h"
+
+// Matchmaking parameters
+#define MATCH_QUEUE_SIZE (1 << 16)  // waiting players per bucket, power of 2
+#define SKILL_BUCKETS_MAX (8)
+#define SKILL_BUCKET_WIDTH (10)     // score points covered by one bucket
+
+// A player waiting for an opponent
+struct ticket {
+	int socket;
+	int record;  // index in score store
+	int score;   // only used to pick the bucket
+};
+
+// Slot of the queue; sequence tells producers and consumers whose turn it is
+struct queue_cell {
+	atomic_size_t sequence;
+	struct ticket ticket;
+};
+
+// Bounded lock-free multi-producer multi-consumer queue of tickets
+struct match_queue {
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+	// Player of this bucket waiting to be paired (packed ticket)
+	_Alignas(CACHE_LINE_SIZE) atomic_uint_least64_t waiting;
+	_Alignas(CACHE_LINE_SIZE) struct queue_cell *cells;
+};
+
+// Pairs waiting players of similar skill
+struct matchmaker {
+	struct match_queue buckets[SKILL_BUCKETS_MAX];
+	int num_buckets;  // 1 disables skill buckets
+};
+
+// PRE: Queue
+// POST: Returns 0 on success, 1 if memory could not be allocated
+int match_queue_init(struct match_queue *);
+
+// PRE: Queue and ticket; safe from any thread
+// POST: Returns 0 if ticket was queued, 1 if queue is full
+int match_queue_push(struct match_queue *, const struct ticket *);
+
+// PRE: Queue; safe from any thread
+// POST: Returns 0 and oldest ticket, 1 if queue is empty
+int match_queue_pop(struct match_queue *, struct ticket *);
+
+// PRE: Matchmaker and number of skill buckets (1 to SKILL_BUCKETS_MAX)
+// POST: Returns 0 on success, 1 if memory could not be allocated
+int matchmaker_init(struct matchmaker *, const int);
+
+// PRE: Matchmaker nobody uses anymore
+// POST: Memory released; sockets of players still waiting are closed
+void matchmaker_destroy(struct matchmaker *);
+
+// PRE: Matchmaker and player looking for a game; safe from any thread
+// POST: Returns 0 if player was queued, 1 if the bucket is full
+int matchmaker_enqueue(struct matchmaker *, const struct ticket *);
+
+// PRE: Matchmaker; safe from any thread
+// POST: Returns 1 and the two players if a pair was formed (player that
+//       waited longer first), 0 if nobody can be paired right now
+int matchmaker_pair(struct matchmaker *, struct ticket *, struct ticket *);
+
+#endif /* MATCHMAKING_H */
@@ -0,0 +1,50 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+// Metrics parameters
+#define METRICS_PORT "9464"                 // local port of the endpoint
+#define METRICS_PORT_ENV "BATTLE_METRICS_PORT"
+#define METRICS_TIMEOUT_S (1)               // time given to a scraper
+#define METRICS_RESPONSE_SIZE (8192)
+#define HISTOGRAM_BUCKETS (12)
+
+// Values counted by every thread and summed when scraped
+enum METRIC {
+	METRIC_SESSIONS,          // sessions allocated minus sessions freed
+	METRIC_TURNS,
+	METRIC_BYTES_SENT,
+	METRIC_BYTES_RECEIVED,
+	METRIC_ERROR_SEND,
+	METRIC_ERROR_RECV,
+	METRIC_ERROR_DISCONNECT,  // peer closed the connection
+	METRIC_ERROR_TIMEOUT,
+	METRIC_ERROR_ACCEPT,
+	METRIC_ERROR_RULES,       // invalid fleet or shot
+	NUM_METRICS
+};
+
+// Durations counted by every thread and summed when scraped
+enum HISTOGRAM {
+	HISTOGRAM_TURN,
+	HISTOGRAM_RENDER,
+	NUM_HISTOGRAMS
+};
+
+// PRE: Metric and amount to add (negative for gauges going down)
+// POST: Amount added to the calling thread's copy of the metric
+void metrics_add(const enum METRIC, const int64_t);
+
+// PRE: Histogram and start time of the section (see now_ns)
+// POST: Duration of the section until now added to the calling thread's
+//       copy of the histogram
+void metrics_observe(const enum HISTOGRAM, const uint64_t);
+
+// PRE: -
+// POST: Metrics served in Prometheus text format on 127.0.0.1 (port
+//       METRICS_PORT or BATTLE_METRICS_PORT) by a thread of their own;
+//       returns 0 on success, 1 otherwise
+int metrics_start(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,94 @@
+#ifndef SCORES_H
+#define SCORES_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "battle.h"
+
+// Score store parameters
+#define SCORE_STORE_PATH "scores.db"
+#define SCORE_STORE_MAGIC (0x53435342u)  // "BSCS"
+#define SCORE_STORE_VERSION (1)
+#define SCORE_STORE_CAPACITY (1 << 20)   // records, at most 3/4 get used
+#define LEADERBOARD_SIZE (10)
+
+// Results are counted in one word so that an update is a single atomic add
+#define RESULT_BITS (21)
+#define RESULT_MASK ((UINT64_C(1) << RESULT_BITS) - 1)
+
+enum RESULT {
+	RESULT_WIN = 0,
+	RESULT_LOSS = 1,
+	RESULT_DRAW = 2
+};
+
+// Fixed-size record per player as stored in the file
+struct score_record {
+	char name[NAME_SIZE];
+	_Atomic uint32_t key;      // 0 empty, 1 being written, hash of name otherwise
+	uint32_t reserved;
+	_Atomic uint64_t results;  // wins, losses, draws (RESULT_BITS each)
+};
+
+// Start of the file
+struct score_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	_Atomic uint64_t count;
+};
+
+// Entry of the leaderboard
+struct score_entry {
+	char name[NAME_SIZE];
+	int score;
+	int wins;
+	int losses;
+	int draws;
+};
+
+// Memory-mapped score store shared by all threads of a process; processes
+// that write it hold a shared flock on the file
+struct score_store {
+	int fd;
+	size_t file_size;
+	struct score_header *header;
+	struct score_record *records;
+};
+
+// PRE: Store, path of the file (created if missing unless read only) and
+//      whether the store is only read; a store opened read only must not
+//      be passed to score_store_lookup() or score_store_record()
+// POST: Returns 0 on success, 1 otherwise; records a crashed process left
+//       half created are only cleared when no other process has the file
+//       open for writing
+int score_store_open(struct score_store *, const char *, const int);
+
+// PRE: Opened store
+// POST: Changes flushed to the file and store closed (which releases its
+//       lock)
+void score_store_close(struct score_store *);
+
+// PRE: Opened store and name of player; safe from any thread
+// POST: Index of record of the player (created if needed), -1 if the
+//       store is full
+int score_store_lookup(struct score_store *, const char *);
+
+// PRE: Opened store and index of record
+// POST: Score of player (2 per win, 1 per draw)
+int score_store_score(const struct score_store *, const int);
+
+// PRE: Opened store, index of record and result of a game; safe from any
+//      thread
+// POST: Result added atomically
+void score_store_record(struct score_store *, const int, enum RESULT);
+
+// PRE: Opened store and buffer for up to LEADERBOARD_SIZE entries
+// POST: Returns number of entries, best player first; the records are
+//       scanned on every call, so results written by other processes
+//       since the store was opened are included
+int score_store_top(struct score_store *, struct score_entry *);
+
+#endif /* SCORES_H */
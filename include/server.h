@@ -0,0 +1,18 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Server parameters
+#define SERVER_ACCEPTORS (2)           // threads accepting players
+#define SERVER_SESSIONS_MAX (4096)     // sessions per game thread
+#define SERVER_GAME_THREADS_MAX (64)
+#define SERVER_POLL_MS (10)            // how often game threads look for pairs
+#define SERVER_ARRIVALS_MAX (1024)     // players sending their name, per game thread
+#define SERVER_NAME_TIMEOUT_S (5)      // time a joining player has to send name
+
+// PRE: Listening socket, number of game threads and of skill buckets
+// POST: Pairs joining players and relays their games, ending those where
+//       a player stays silent longer than its clock allows; only returns
+//       on error (1)
+int run_server(const int, const int, const int);
+
+#endif /* SERVER_H */
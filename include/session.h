@@ -0,0 +1,107 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "battle.h"
+
+#define CACHE_LINE_SIZE (64)
+
+// Next message expected from a side of a relayed match
+enum PHASE {
+	PHASE_BOARD,
+	PHASE_MAP,
+	PHASE_SHOT,
+	PHASE_REPLY
+};
+
+// Compact record of a game, enough to rebuild any earlier turn
+struct snapshot {
+	unsigned char origin[2][NUM_SHIPS];    // top-left most cell of ships
+	unsigned char vertical[2][NUM_SHIPS];
+	unsigned char shots[2][BOARD_SIZE];    // cells shot by each side, in order
+	int num_shots[2];
+};
+
+// State of one match; both sides are indexed by enum PLAYER
+struct session {
+	int socket[2];
+	int record[2];  // index of players in score store (server only)
+	int ship_count[2];
+	int coords[2][2];
+	char board[2][BOARD_SIZE];
+	int map[2][BOARD_SIZE];
+	struct ship_t ships[2][NUM_SHIPS];
+	// Socket buffers for messages in transit (on host/join: the opponent's shot)
+	char buf[2][FLEET_MESSAGE_SIZE];
+	int buf_len[2];
+	// Relay state of the messages sent by each side (server only)
+	int phase[2];
+	int expected[2];  // size of message being received in buf
+	int sent[2];      // bytes of a complete message already forwarded
+	int shots[2];
+	uint64_t turn_start[2];  // when each side's current turn began
+	uint64_t last_active[2];  // when each side was last heard from or began to
+	                          // owe a message (server)
+	char reply[2];
+	int closing;  // no rematch, end once replies are delivered (server)
+	              // or once the results are shown (host/join)
+	uint64_t time_left;  // nanoseconds the player has left for shots (host/join)
+	struct snapshot snapshot;
+};
+
+// Fixed-size pool of sessions, owned by a single thread
+struct session_pool {
+	char *memory;      // all slots, allocated once
+	size_t slot_size;  // size of a session rounded up to a cache line
+	size_t capacity;
+	void *free_list;   // unused slots, most recently freed first
+	size_t live;
+	size_t peak;
+};
+
+// PRE: Pool and maximum number of sessions
+// POST: All memory of the pool allocated upfront; returns 0 on success,
+//       1 otherwise
+int session_pool_init(struct session_pool *, const size_t);
+
+// PRE: Initialized pool without live sessions
+// POST: Memory of pool released
+void session_pool_destroy(struct session_pool *);
+
+// PRE: Initialized pool
+// POST: Cache-line aligned session in O(1), reset for a new game;
+//       NULL if pool is exhausted
+struct session *session_alloc(struct session_pool *);
+
+// PRE: Session handed out by the same pool
+// POST: Session returned to pool in O(1)
+void session_free(struct session_pool *, struct session *);
+
+// PRE: Session
+// POST: Boards, maps, ships and counters reset for a new game; sockets
+//       and buffers are kept
+void session_reset(struct session *);
+
+// PRE: Session whose fleets were both placed and exchanged
+// POST: Placements recorded, shot history cleared
+void snapshot_placements(struct session *);
+
+// PRE: Session and cell shot by the given side
+// POST: Shot appended to history of side
+void snapshot_shot(struct session *, const int, const int);
+
+// PRE: Session with recorded placements
+// POST: Number of turns completed by both sides
+int snapshot_turn(const struct session *);
+
+// PRE: Session with recorded placements
+// POST: Checksum of both fleets, equal on both sides of the game
+uint32_t snapshot_checksum(const struct session *);
+
+// PRE: Session with recorded placements and a turn it already completed
+// POST: Boards, maps, ships and history rebuilt as they were after turn
+void snapshot_restore(struct session *, const int);
+
+#endif /* SESSION_H */
@@ -0,0 +1,14 @@
+#ifndef TOURNAMENT_H
+#define TOURNAMENT_H
+
+// Tournament parameters
+#define TOURNAMENT_GAMES_MAX (4096)  // games played at once
+
+// PRE: Number of games and engines of both sides (see engine_open); NULL
+//      as second engine plays that side with the built-in bot
+// POST: All games played at once, in rounds of one batch per engine, with
+//       the rules of shoot(); results printed; returns 0 on success, 1 if
+//       an engine could not be started
+int run_tournament(const int, const char *, const char *);
+
+#endif /* TOURNAMENT_H */
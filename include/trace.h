@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "clock.h"
+
+// Tracing parameters
+#define TRACE_BUFFER_EVENTS (1 << 16)  // events kept per thread
+#define TRACE_FILE_ENV "BATTLE_TRACE_FILE"
+
+// Trace points compile to nothing unless built with BATTLE_TRACE
+// (make TRACE=1):
+//     TRACE_BEGIN(t);
+//     ...
+//     TRACE_END("name", t);
+#ifdef BATTLE_TRACE
+#define TRACE_BEGIN(start) const uint64_t start = now_ns()
+#define TRACE_END(name, start) trace_event(name, start)
+#else
+#define TRACE_BEGIN(start)
+#define TRACE_END(name, start)
+#endif
+
+// PRE: Static name of the traced section and its start time
+// POST: Section recorded in the buffer of the calling thread; dropped if
+//       the buffer is full
+void trace_event(const char *, const uint64_t);
+
+// PRE: -
+// POST: Events of all threads written as Chrome trace JSON to the file
+//       named by BATTLE_TRACE_FILE (battle-trace-<pid>.json by default)
+void trace_dump(void);
+
+#endif /* TRACE_H */
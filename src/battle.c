@@ -1,5 +1,10 @@
 #include "battle.h"
+#include "clock.h"
+#include "input.h"
+#include "metrics.h"
+#include "trace.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 // Global array of ships for both player and opponent
@@ -19,17 +24,34 @@ struct ship_t opponent_ships[NUM_SHIPS] = {
 };
 
 // PRE: Checks if input is valid by comparing against expected value
+//      (INPUT_END and INPUT_TIMEOUT count as valid, there is nothing to
+//      retry)
 // POST: -
 int is_valid_input(const int given, const int expected) {
-	if (given != expected) {
-		printf("Expected exactly %d argument(s)\n", expected);
-		int ans = scanf("%*s");  // Ignore invalid input
-		(void) ans;  // Don't warn me
+	if (given != expected && given >= 0) {
+		prompt("Expected exactly %d argument(s)\n", expected);
+		input_skip();  // Ignore invalid input
 		return 0;
 	}
 	return 1;
 }
 
+// PRE: Coordinates to read
+// POST: Row and column entered by player (one-based); returns 0,
+//       INPUT_END or INPUT_TIMEOUT if the input ended or the deadline
+//       passed first
+int read_coords(int *row, int *col) {
+	int coords[2];
+	int given;
+	while(!is_valid_input(given = input_ints(coords, 2), 2));
+	if (given < 0) {
+		return given;
+	}
+	*row = coords[0];
+	*col = coords[1];
+	return 0;
+}
+
 // PRE: Print a character in a certain color to console
 // POST: -
 inline void print_char_col(const char c, const unsigned int color) {
@@ -71,19 +93,11 @@ inline void print_str_col(const char *str, const unsigned int color) {
 // POST: -
 void print_results(const int row, const int col, const int is_hit, 
                    enum PLAYER player_type) {
-	
-	if (player_type == SELF) {
-	    printf("You shot: (%d, %d) ", row, col);
-	} else {
-	    printf("Opponent shot: (%d, %d) ", row, col);
-	}
-	
-	if (is_hit) {
-		print_str_col("HIT!", RED);
-	} else {
-		print_str_col("MISS!", CYAN);
-	}
-	printf("\n");
+	log_fields("player=%s row=%d col=%d hit=%d",
+	           (player_type == SELF) ? "self" : "opponent", row, col, is_hit);
+	log_write(chatter_level(), "shot", "%s shot: (%d, %d) \033[1;%dm%s\033[0m",
+	          (player_type == SELF) ? "You" : "Opponent", row, col,
+	          is_hit ? RED : CYAN, is_hit ? "HIT!" : "MISS!");
 }
 
 // PRE: Fills player board with '*' (water)
@@ -125,6 +139,40 @@ int is_overlap(const char *board, const int length,
 	return 0;
 }
 
+// PRE: Apply shot at zero-based board index without any output
+// POST: -1 if index was invalid or already shot, 0 if MISS, 1 if HIT;
+//       sunk_id set to id of destroyed ship, -1 otherwise
+int apply_shot(const int index, char *board, const int *map,
+               int *counter, struct ship_t *ships, int *sunk_id) {
+	*sunk_id = -1;
+	if (index < 0 || index >= BOARD_SIZE) {
+		return -1;
+	}
+	const char target = board[index];
+	
+	// Make sure location hasn't been shot already
+	if (target == SHIP) {
+		// Shoot! Indicate whether the ship was hit or missed
+		board[index] = HIT;
+		// Check which ship was hit
+		const int ship_id = map[index];
+		struct ship_t *target_ship = &ships[ship_id];
+		// Increment hit counter of ship and check if it was destroyed
+		if (++target_ship->hits_taken == target_ship->length) {
+			*sunk_id = ship_id;
+		}
+		// Update counter
+		(*counter)--;
+		
+		return 1;
+	} else if (target == WATER) {
+		board[index] = MISS;
+		
+		return 0;
+	}
+	return -1;
+}
+
 // PRE: Shoot opponent board at given coordinates
 // POST: -1 if target coordinates were invalid, 0 if MISS 1 if HIT
 int shoot(const int row, const int col, char *board, const int *map,
@@ -132,51 +180,95 @@ int shoot(const int row, const int col, char *board, const int *map,
 	const int r = row - 1;	
 	const int c = col - 1;
 		
-	if (is_inside(r, c)) {
-		const int index = r * BOARD_LENGTH + c;
-		const char target = board[index];
-		
-		// Make sure location hasn't been shot already
-		if (target == SHIP) {
-			// Shoot! Indicate whether the ship was hit or missed
-			board[index] = HIT;
-			// Check which ship was hit
-			const int ship_id = map[index];
-			struct ship_t *target_ship = &ships[ship_id];
-			// Increment hit counter of ship
-			int hits = ++target_ship->hits_taken;
-			// Check if ship was destroyed
-			char message_buf[MESSAGE_SIZE_MAX];
-			int ans;
-			if (hits == target_ship->length) {
-				if (player_type == SELF) {
-					ans = sprintf(message_buf, "Your %s has been destroyed!", target_ship->name);
-					print_str_col(message_buf, RED);
-					printf("\n");
-				} else {
-				    ans = sprintf(message_buf, "Enemy %s has been destroyed!", target_ship->name);
-					print_str_col(message_buf, GREEN);
-					printf("\n");
-				}
+	if (!is_inside(r, c)) {
+		return -1;
+	}
+	int sunk_id;
+	const int is_hit = apply_shot(r * BOARD_LENGTH + c, board, map, 
+	                              counter, ships, &sunk_id);
+	// Check if ship was destroyed
+	if (sunk_id >= 0) {
+		log_fields("player=%s ship=%s", (player_type == SELF) ? "self" : "opponent",
+		           ships[sunk_id].name);
+		log_write(chatter_level(), "sunk", "\033[1;%dm%s %s has been destroyed!\033[0m",
+		          (player_type == SELF) ? RED : GREEN,
+		          (player_type == SELF) ? "Your" : "Enemy", ships[sunk_id].name);
+	}
+	return is_hit;
+}
+
+// PRE: Board and ship map received from another player
+// POST: 1 if every ship lies fully inside the board as one straight,
+//       contiguous segment of its length, 0 otherwise
+int is_valid_fleet(const char *board, const int *map) {
+	int first[NUM_SHIPS], cells[NUM_SHIPS];
+	int i, k;
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		first[i] = -1;
+		cells[i] = 0;
+	}
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		const int ship_id = map[i];
+		if (ship_id == -1) {
+			if (board[i] != WATER) {
+				return 0;
 			}
-			(void) ans;  // Don't warn me
-			// Update counter
-			(*counter)--;
-			
-			return 1;  // ok
-		} else if (target == WATER) {
-			board[index] = MISS;
-			
-			return 0;  // ok
+			continue;
 		}
-		
+		if (ship_id < 0 || ship_id >= NUM_SHIPS || board[i] != SHIP) {
+			return 0;
+		}
+		if (first[ship_id] == -1) {
+			first[ship_id] = i;
+		}
+		cells[ship_id]++;
 	}
-	return -1;
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		const int length = player_ships[i].length;
+		if (cells[i] != length) {
+			return 0;
+		}
+		// All parts must follow the first one along a row or a column
+		const int r = first[i] / BOARD_LENGTH;
+		const int c = first[i] % BOARD_LENGTH;
+		const int step = (length > 1 && c + 1 < BOARD_LENGTH && 
+		                  map[first[i] + 1] == i) ? 1 : BOARD_LENGTH;
+		if (step == 1 && !is_inside(r, c + length - 1)) {
+			return 0;
+		}
+		if (step == BOARD_LENGTH && !is_inside(r + length - 1, c)) {
+			return 0;
+		}
+		for (k = 0; k < length; ++k) {
+			if (map[first[i] + k * step] != i) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+// PRE: Ship map and id of a ship placed on it
+// POST: Zero-based origin (top-left most part) and orientation of the ship
+void locate_ship(const int *map, const int ship_id, int *row, int *col,
+                 enum ORIENTATIONS *o) {
+	int first = 0;
+	while (map[first] != ship_id) {
+		first++;
+	}
+	*row = first / BOARD_LENGTH;
+	*col = first % BOARD_LENGTH;
+	*o = (*col + 1 < BOARD_LENGTH && map[first + 1] == ship_id) ? HORIZONTAL : VERTICAL;
 }
 
 // PRE: Draws board to console
 // POST: -
 void draw_board(const char *board) {
+	if (is_batch()) {
+		return;
+	}
+	log_flush_console();  // messages of the last turn come before the board
+	const uint64_t t_render = now_ns();
 	const char separator[] = "-----------------------------------------";
 	
 	// Print header
@@ -210,6 +302,8 @@ void draw_board(const char *board) {
 		row++;		
 	}
 	printf("   %s\n", separator);
+	metrics_observe(HISTOGRAM_RENDER, t_render);
+	TRACE_END("render", t_render);
 }
 
 // PRE: Draws player board (left) next to opponent board (right)
@@ -217,6 +311,11 @@ void draw_board(const char *board) {
 void draw_board_side_by_side(const char *player_board, 
                              const char *opponent_board,
                              enum STATE game_state) {
+	if (is_batch()) {
+		return;
+	}
+	log_flush_console();  // messages of the last turn come before the board
+	const uint64_t t_render = now_ns();
 	const char separator[] = "-----------------------------------------";
 	const char line[] = "   |   ";
 	// Print header
@@ -276,27 +375,37 @@ void draw_board_side_by_side(const char *player_board,
 		row++;		
 	}
 	printf("   %s%s%s\n", separator, line, separator);
+	metrics_observe(HISTOGRAM_RENDER, t_render);
+	TRACE_END("render", t_render);
 }
 
 // PRE: Place all ships within board given player input
-// POST: -
-void place_ship(const struct ship_t *ship, char *player_board,
-                int *player_map, const int ship_id) {
-	printf("Placing ship of type %s and length %d:\n", ship->name, ship->length);
-	printf("Enter orientation: (h)orizontal/(v)ertical ");
+// POST: Returns 0, INPUT_END or INPUT_TIMEOUT if the input ended or the
+//       deadline passed before the ship was placed
+int place_ship(const struct ship_t *ship, char *player_board,
+               int *player_map, const int ship_id) {
+	prompt("Placing ship of type %s and length %d:\n", ship->name, ship->length);
+	prompt("Enter orientation: (h)orizontal/(v)ertical ");
 	char orientation;
-	while(!is_valid_input(scanf("%c", &orientation), 1));
-	while (orientation != HORIZONTAL && orientation != VERTICAL) {
-		while(!is_valid_input(scanf("%c", &orientation), 1));
-	}
+	int given;
+	do {
+		while(!is_valid_input(given = input_char(&orientation), 1));
+		if (given < 0) {
+			return given;
+		}
+	} while (orientation != HORIZONTAL && orientation != VERTICAL);
 	
 	int row, col;
-	printf("Enter: ");
-	print_str_col("row", GREEN);
-	printf(" ");
-	print_str_col("col", MAGENTA); 
-	printf(" of origin (top-left most ship part): ");
-	while(!is_valid_input(scanf("%d %d", &row, &col), 2));
+	if (!is_batch()) {
+		printf("Enter: ");
+		print_str_col("row", GREEN);
+		printf(" ");
+		print_str_col("col", MAGENTA); 
+		printf(" of origin (top-left most ship part): ");
+	}
+	if ((given = read_coords(&row, &col)) != 0) {
+		return given;
+	}
 	
 	// zero-based
 	row = row - 1;
@@ -307,16 +416,20 @@ void place_ship(const struct ship_t *ship, char *player_board,
 	if (orientation == HORIZONTAL) {
 		// Make sure current ship lies within board
 		while (col < 0 || !is_inside(row, col + ship->length - 1)) {
-			printf("\nShip is outside of bounds, try again: ");
-			while(!is_valid_input(scanf("%d %d", &row, &col), 2));
+			prompt("\nShip is outside of bounds, try again: ");
+			if ((given = read_coords(&row, &col)) != 0) {
+				return given;
+			}
 			// zero-based
 	        row = row - 1;
 	        col = col - 1;
 		}
 		// Make sure current ship does not overlap with previous ships
 		while (is_overlap(player_board, ship->length, row, col, HORIZONTAL)) {
-			printf("\nShips overlap, try again: ");
-			while(!is_valid_input(scanf("%d %d", &row, &col), 2));
+			prompt("\nShips overlap, try again: ");
+			if ((given = read_coords(&row, &col)) != 0) {
+				return given;
+			}
 			// zero-based
 	        row = row - 1;
 	        col = col - 1;
@@ -330,16 +443,20 @@ void place_ship(const struct ship_t *ship, char *player_board,
 	} else {
 		// Make sure current ship lies within board
 		while (row < 0 || !is_inside(row + ship->length - 1, col)) {
-			printf("\nShip is outside of bounds, try again: ");
-			while(!is_valid_input(scanf("%d %d", &row, &col), 2));
+			prompt("\nShip is outside of bounds, try again: ");
+			if ((given = read_coords(&row, &col)) != 0) {
+				return given;
+			}
 			// zero-based
 	        row = row - 1;
 	        col = col - 1;
 		}
 		// Make sure current ship does not overlap with previous ships
 		while (is_overlap(player_board, ship->length, row, col, VERTICAL)) {
-			printf("\nShips overlap, try again: ");
-			while(!is_valid_input(scanf("%d %d", &row, &col), 2));
+			prompt("\nShips overlap, try again: ");
+			if ((given = read_coords(&row, &col)) != 0) {
+				return given;
+			}
 			// zero-based
 	        row = row - 1;
 	        col = col - 1;
@@ -353,19 +470,63 @@ void place_ship(const struct ship_t *ship, char *player_board,
 			index += BOARD_LENGTH;
 		}
 	}
+	return 0;
 }
 
 // PRE: Based on user input, place all ships in board
-// POST: -
-void place_all_ships(char *player_board, int *player_map) {
+// POST: Returns 0, INPUT_END or INPUT_TIMEOUT if the input ended or the
+//       deadline passed and the ships left were placed at random
+int place_all_ships(char *player_board, int *player_map) {
+	TRACE_BEGIN(t_place);
+	int status = 0;
 	// Draw board
 	draw_board(player_board);
 	
 	int i;
 	for (i = 0; i < NUM_SHIPS; ++i) {
 		const struct ship_t current = player_ships[i];
-		place_ship(&current, player_board, player_map, i);
+		if ((status = place_ship(&current, player_board, player_map, i)) != 0) {
+			log_write(chatter_level(), "input", "%s, placing your other ships at random",
+			          (status == INPUT_END) ? "End of input" : "Out of time");
+			unsigned int seed = (unsigned int)now_ns();
+			place_remaining_ships(player_board, player_map, i, &seed);
+		}
 			
 		draw_board(player_board);
+		if (status != 0) {
+			break;
+		}
+	}
+	TRACE_END("place_all_ships", t_place);
+	return status;
+}
+
+// PRE: Empty board and ship map, state of the caller's random generator
+// POST: All ships placed at random, legal positions
+void place_random_ships(char *board, int *map, unsigned int *seed) {
+	place_remaining_ships(board, map, 0, seed);
+}
+
+// PRE: Board and ship map holding the ships before the first one given,
+//      state of the caller's random generator
+// POST: That ship and all after it placed at random, legal positions
+void place_remaining_ships(char *board, int *map, const int first, unsigned int *seed) {
+	int i, k;
+	for (i = first; i < NUM_SHIPS; ++i) {
+		const int length = player_ships[i].length;
+		const int span = BOARD_LENGTH - length + 1;  // possible origins along ship
+		enum ORIENTATIONS o;
+		int row, col;
+		do {
+			o = (rand_r(seed) & 1) ? HORIZONTAL : VERTICAL;
+			row = rand_r(seed) % (o == VERTICAL ? span : BOARD_LENGTH);
+			col = rand_r(seed) % (o == HORIZONTAL ? span : BOARD_LENGTH);
+		} while (is_overlap(board, length, row, col, o));
+		
+		const int step = (o == HORIZONTAL) ? 1 : BOARD_LENGTH;
+		for (k = 0; k < length; ++k) {
+			board[row * BOARD_LENGTH + col + k * step] = SHIP;
+			map[row * BOARD_LENGTH + col + k * step] = i;
+		}
 	}
 }
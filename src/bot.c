@@ -0,0 +1,235 @@
+#include "bot.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Zobrist keys; generated from a fixed seed so that hashes (and cache
+// files) stay valid across runs
+#define ZOBRIST_SEED (0x42617474u)
+static uint64_t zobrist_cells[BOARD_SIZE][NUM_CELLS];
+static uint64_t zobrist_sunk[NUM_SHIPS];
+static uint64_t zobrist_empty;  // hash of the empty board is never 0
+static pthread_once_t zobrist_once = PTHREAD_ONCE_INIT;
+
+// Decisions shared by all bots of the process
+static struct bot_cache_entry *cache = NULL;
+
+// PRE: State of generator
+// POST: Next pseudo-random number (splitmix64)
+static uint64_t next_random(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+	return z ^ (z >> 31);
+}
+
+// PRE: -
+// POST: Zobrist keys generated
+static void init_zobrist(void) {
+	uint64_t state = ZOBRIST_SEED;
+	int i, k;
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		for (k = 0; k < NUM_CELLS; ++k) {
+			// Unknown cells are not part of the hash
+			zobrist_cells[i][k] = (k == CELL_UNKNOWN) ? 0 : next_random(&state);
+		}
+	}
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		zobrist_sunk[i] = next_random(&state);
+	}
+	zobrist_empty = next_random(&state);
+}
+
+// PRE: Path of a cache file to warm start from, NULL for a cold cache
+// POST: Shared cache of decisions allocated (and loaded if the file is
+//       valid); returns 0 on success, 1 otherwise
+int bot_cache_init(const char *path) {
+	cache = calloc(BOT_CACHE_ENTRIES, sizeof(*cache));
+	if (cache == NULL) {
+		fprintf(stderr, "Could not allocate bot cache\n");
+		return 1;
+	}
+	if (path == NULL) {
+		return 0;
+	}
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return 0;  // nothing to warm start from yet
+	}
+	struct bot_cache_header header;
+	const ssize_t size = BOT_CACHE_ENTRIES * sizeof(*cache);
+	if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+	    header.magic != BOT_CACHE_MAGIC || header.version != BOT_CACHE_VERSION ||
+	    header.entries != BOT_CACHE_ENTRIES || read(fd, cache, size) != size) {
+		fprintf(stderr, "Ignoring invalid bot cache %s\n", path);
+		memset(cache, 0, size);
+	}
+	close(fd);
+	return 0;
+}
+
+// PRE: Initialized cache and path of cache file
+// POST: Cache written to file; returns 0 on success, 1 otherwise
+int bot_cache_save(const char *path) {
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("Could not save bot cache");
+		return 1;
+	}
+	const struct bot_cache_header header = {
+		BOT_CACHE_MAGIC, BOT_CACHE_VERSION, BOT_CACHE_ENTRIES
+	};
+	const ssize_t size = BOT_CACHE_ENTRIES * sizeof(*cache);
+	const int status = (write(fd, &header, sizeof(header)) != sizeof(header) ||
+	                    write(fd, cache, size) != size);
+	if (status != 0) {
+		perror("Could not save bot cache");
+	}
+	close(fd);
+	return status;
+}
+
+// PRE: Cache nobody uses anymore
+// POST: Memory released; bots compute every decision again
+void bot_cache_destroy(void) {
+	free(cache);
+	cache = NULL;
+}
+
+// PRE: Bot
+// POST: Bot knows nothing about the opponent board (start of a game)
+void bot_reset(struct bot *b) {
+	pthread_once(&zobrist_once, init_zobrist);
+	memset(b->cells, CELL_UNKNOWN, sizeof(b->cells));
+	int i;
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		b->sunk[i] = 0;
+	}
+	b->hash = zobrist_empty;
+}
+
+// PRE: Bot, cell and what is known about it now
+// POST: Cell and hash updated
+static void set_cell(struct bot *b, const int index, const enum CELL cell) {
+	b->hash ^= zobrist_cells[index][b->cells[index]] ^ zobrist_cells[index][cell];
+	b->cells[index] = cell;
+}
+
+// PRE: Bot, board index shot, whether it hit, id of the ship it destroyed
+//      (-1 if none) and the opponent's ship map, which reveals the cells of
+//      destroyed ships only
+// POST: Observed state and its hash updated incrementally
+void bot_observe(struct bot *b, const int index, const int is_hit,
+                 const int sunk_id, const int *map) {
+	set_cell(b, index, is_hit ? CELL_HIT : CELL_MISS);
+	if (sunk_id < 0) {
+		return;
+	}
+	b->sunk[sunk_id] = 1;
+	b->hash ^= zobrist_sunk[sunk_id];
+	int i;
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		if (map[i] == sunk_id) {
+			set_cell(b, i, CELL_SUNK);
+		}
+	}
+}
+
+// PRE: Bot, opponent board as drawn, ship map and ships
+// POST: Bot knows what the player has seen of that board: hits, misses and
+//       cells of destroyed ships
+void bot_observe_board(struct bot *b, const char *board, const int *map,
+                       const struct ship_t *ships) {
+	bot_reset(b);
+	int i;
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		if (board[i] == HIT || board[i] == MISS) {
+			bot_observe(b, i, board[i] == HIT, -1, map);
+		}
+	}
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		if (ships[i].hits_taken == ships[i].length) {
+			int k;
+			for (k = 0; map[k] != i; ++k);
+			bot_observe(b, k, 1, i, map);
+		}
+	}
+}
+
+// PRE: Bot with at least one unknown cell
+// POST: Unknown cell covered by the most (weighted) placements of the
+//       ships still afloat; placements through hits weigh more
+static int choose_by_density(const struct bot *b) {
+	unsigned int density[BOARD_SIZE] = {0};
+	int i, k, r, c;
+
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		if (b->sunk[i]) {
+			continue;
+		}
+		const int length = player_ships[i].length;
+		int o;
+		for (o = 0; o < 2; ++o) {
+			const int step = (o == 0) ? 1 : BOARD_LENGTH;  // horizontal, vertical
+			const int rows = (step == 1) ? BOARD_LENGTH : BOARD_LENGTH - length + 1;
+			const int cols = (step == 1) ? BOARD_LENGTH - length + 1 : BOARD_LENGTH;
+			for (r = 0; r < rows; ++r) {
+				for (c = 0; c < cols; ++c) {
+					const int origin = r * BOARD_LENGTH + c;
+					int hits = 0;
+					for (k = 0; k < length; ++k) {
+						const int cell = b->cells[origin + k * step];
+						if (cell == CELL_MISS || cell == CELL_SUNK) {
+							break;
+						}
+						hits += (cell == CELL_HIT);
+					}
+					if (k < length) {
+						continue;  // ship cannot lie here
+					}
+					const unsigned int weight = hits ? BOT_HIT_WEIGHT * hits : 1;
+					for (k = 0; k < length; ++k) {
+						if (b->cells[origin + k * step] == CELL_UNKNOWN) {
+							density[origin + k * step] += weight;
+						}
+					}
+				}
+			}
+		}
+	}
+	// Lowest index wins ties, so equal states always get the same move
+	int best = -1;
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		if (b->cells[i] == CELL_UNKNOWN && (best < 0 || density[i] > density[best])) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+// PRE: Bot with at least one unknown cell
+// POST: Board index to shoot next, taken from the cache if this state was
+//       decided before, by ship density otherwise
+int bot_choose(struct bot *b) {
+	if (cache == NULL) {
+		return choose_by_density(b);
+	}
+	struct bot_cache_entry *entry = &cache[b->hash & (BOT_CACHE_ENTRIES - 1)];
+	b->lookups++;
+	const uint64_t check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+	const uint64_t move = atomic_load_explicit(&entry->move, memory_order_relaxed);
+	// A torn or foreign entry fails the check; the move is checked anyway
+	// in case two states collide in all 64 bits
+	if ((check ^ move) == b->hash && move < BOARD_SIZE &&
+	    b->cells[move] == CELL_UNKNOWN) {
+		b->cache_hits++;
+		return (int)move;
+	}
+	const int best = choose_by_density(b);
+	atomic_store_explicit(&entry->move, (uint64_t)best, memory_order_relaxed);
+	atomic_store_explicit(&entry->check, b->hash ^ (uint64_t)best, memory_order_relaxed);
+	return best;
+}
@@ -1,7 +1,21 @@
 #include "battle.h"
+#include "bot.h"
+#include "clock.h"
 #include "communicate.h"
+#include "input.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
 
+#include <errno.h>
+#include <poll.h>
+
+#ifndef PORT
 #define PORT "8888"
+#endif
+
+// Address of host we joined
+static char host_ip[INET_ADDRSTRLEN];
 
 // PRE: Socket of peer and send buffer + length
 // POST: Blocks until all data has been successfully sent
@@ -11,12 +25,14 @@ int send_full(const int socket_peer, const void *buf, int message_len) {
     
     while (begin < message_len) {
         bytes_sent = send(socket_peer, (void *)((char *)buf + begin), 
-            message_len - begin, 0);
+            message_len - begin, MSG_NOSIGNAL);  // report lost peer as error
         if (bytes_sent < 0) {
+            metrics_add(METRIC_ERROR_SEND, 1);
             return bytes_sent;  // error
         }
         begin += bytes_sent;
     }
+    metrics_add(METRIC_BYTES_SENT, begin);
     // DEBUG
     assert(begin == message_len);
     
@@ -33,10 +49,18 @@ int recv_full(const int socket_peer, const void *buf, int message_len) {
         bytes_recv = recv(socket_peer, (void *)((char *)buf + begin), 
             message_len - begin, 0);
         if (bytes_recv <= 0) {
+            if (bytes_recv == 0) {
+                metrics_add(METRIC_ERROR_DISCONNECT, 1);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                metrics_add(METRIC_ERROR_TIMEOUT, 1);
+            } else {
+                metrics_add(METRIC_ERROR_RECV, 1);
+            }
             return bytes_recv;  // error/shutdown
         }
         begin += bytes_recv;
     }
+    metrics_add(METRIC_BYTES_RECEIVED, begin);
     // DEBUG
     assert(begin == message_len);
     
@@ -54,13 +78,13 @@ int hostname_to_ip(const char *hostname, char *ipstr) {
 	hints.ai_family = AF_INET;  // IPv4
 	
 	if ((status = getaddrinfo(hostname, NULL, &hints, &res))) {
-		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+		log_write(LOG_ERROR, "resolve", "getaddrinfo: %s", gai_strerror(status));
 		return status;
 	}
     
 	if ((status = getnameinfo(res->ai_addr, res->ai_addrlen, ipstr,
             INET_ADDRSTRLEN, NULL, 0, NI_NUMERICHOST))) {
-        fprintf(stderr, "getnameinfo: %s\n", gai_strerror(status));
+        log_write(LOG_ERROR, "resolve", "getnameinfo: %s", gai_strerror(status));
         return status;
     }
 	// clean-up
@@ -69,224 +93,492 @@ int hostname_to_ip(const char *hostname, char *ipstr) {
 	return 0;	
 }
 
+// PRE: Socket to listen on and number of pending connections allowed
+// POST: Returns 0 on success, error code otherwise
+int listen_players(int *socket_listen, const int backlog) {
+    assert(socket_listen != NULL);
+    int status;
+    
+	// Fetch hostname
+	char my_hostname[HOST_NAME_MAX];
+	
+	if (gethostname(my_hostname, HOST_NAME_MAX) != 0) {
+		log_write(LOG_ERROR, "listen", "Could not fetch hostname");
+		return 1;
+	}
+	log_write(chatter_level(), "listen", "Hosting from: %s", my_hostname);
+	
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;  // IPv4
+    hints.ai_socktype = SOCK_STREAM;  // TCP
+    hints.ai_flags = AI_PASSIVE;  // suitable for binding
+    
+    struct addrinfo *bind_address;
+    
+    if ((status = getaddrinfo(NULL, PORT, &hints, &bind_address))) {
+        log_write(LOG_ERROR, "listen", "getaddrinfo: %s", gai_strerror(status));
+        return status;
+    }
+    
+	// Initializing socket
+	*socket_listen = socket(bind_address->ai_family, 
+        bind_address->ai_socktype, bind_address->ai_protocol);
+        
+	if (*socket_listen < 0) {
+		log_errno("listen", "Failed to create socket");
+        return *socket_listen;
+	}
+	log_write(chatter_level(), "listen", "Socket created");
+
+	// Allow restarting the host while old connections linger in TIME_WAIT
+	const int reuse = 1;
+	setsockopt(*socket_listen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	// Bind socket
+	if ((status = bind(*socket_listen, bind_address->ai_addr, 
+            bind_address->ai_addrlen)) < 0) {
+		log_errno("listen", "Failed to bind socket");
+		return status;
+	}
+    // Free resources
+    freeaddrinfo(bind_address);
+	log_write(chatter_level(), "listen", "Bind done");
+	
+	if (listen(*socket_listen, backlog) < 0) {
+        log_errno("listen", "Listen failed. Error");
+        return 1;
+    }
+	return 0;
+}
+
+// PRE: Listening socket
+// POST: Blocks until a player connected; returns 0 on success
+int accept_player(const int socket_listen, int *socket_peer) {
+    struct sockaddr_storage client_address;
+    socklen_t client_len = sizeof(client_address);
+    
+	*socket_peer = accept(socket_listen, (struct sockaddr *)&client_address,
+        &client_len);
+        
+	if (*socket_peer < 0) {
+		metrics_add(METRIC_ERROR_ACCEPT, 1);
+		log_errno("accept", "Failed to accept client");
+		return *socket_peer;
+	}
+	log_fields("socket=%d", *socket_peer);
+	log_write(chatter_level(), "accept", "Connection successful");
+	return 0;
+}
+
+// PRE: IP address of host
+// POST: Connected to host; returns 0 on success, error code otherwise
+int join_host(const char *ipstr, int *socket_peer) {
+    int status;
+    
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    struct addrinfo *peer_address;
+    
+    if ((status = getaddrinfo(ipstr, PORT, &hints, &peer_address))) {
+        log_write(LOG_ERROR, "join", "getaddrinfo: %s", gai_strerror(status));
+        return status;
+    }
+    
+	*socket_peer = socket(peer_address->ai_family, 
+        peer_address->ai_socktype, peer_address->ai_protocol);
+    
+	if (*socket_peer < 0) {
+		log_errno("join", "Failed to create socket");
+        return *socket_peer;
+	}
+	log_write(chatter_level(), "join", "Socket created");
+	
+	// Connect to host
+	if ((status = connect(*socket_peer, peer_address->ai_addr, 
+            peer_address->ai_addrlen) < 0)) {
+		log_errno("join", "Connect failed. Error");
+		close(*socket_peer);
+		freeaddrinfo(peer_address);
+		return status;
+	}
+    // Free resources
+    freeaddrinfo(peer_address);
+	return 0;
+}
+
 // PRE: Connects host (server) with joinee (client)
 // POST: Returns 0 on success, 1 otherwise
 int connect_players(int *socket_listen, int *socket_peer, enum MODE mode) {
     assert(socket_listen != NULL && socket_peer != NULL);
     int status;
+    TRACE_BEGIN(t_connect);
     
 	if (mode == HOST) {
-		// Fetch hostname
-		char my_hostname[HOST_NAME_MAX];
-		
-		if (gethostname(my_hostname, HOST_NAME_MAX) != 0) {
-			fprintf(stderr, "Could not fetch hostname\n");
-			return 1;
-		}
-		printf("Hosting from: %s\n", my_hostname);
-		
-        struct addrinfo hints;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;  // IPv4
-        hints.ai_socktype = SOCK_STREAM;  // TCP
-        hints.ai_flags = AI_PASSIVE;  // suitable for binding
-        
-        struct addrinfo *bind_address;
-        
-        if ((status = getaddrinfo(NULL, PORT, &hints, &bind_address))) {
-            fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
-            return status;
-        }
-        
-		// Initializing socket
-		*socket_listen = socket(bind_address->ai_family, 
-            bind_address->ai_socktype, bind_address->ai_protocol);
-            
-		if (*socket_listen < 0) {
-			perror("Failed to create socket");
-            return *socket_listen;
-		}
-		printf("Socket created\n");
-		
-		// Bind socket
-		if ((status = bind(*socket_listen, bind_address->ai_addr, 
-                bind_address->ai_addrlen)) < 0) {
-			perror("Failed to bind socket");
+		// Listen for 1 client
+		if ((status = listen_players(socket_listen, 1)) != 0) {
 			return status;
 		}
-        // Free resources
-        freeaddrinfo(bind_address);
-		printf("Bind done\n");
-		
-		// Listen for 1 client
-		if (listen(*socket_listen, 1) < 0) {
-            perror("Listen failed. Error");
-            return 1;
-        }
 		
 		// Accept any incoming connection
-		printf("Waiting for opponent to join...\n");
+		log_write(chatter_level(), "connect", "Waiting for opponent to join...");
 		
-        struct sockaddr_storage client_address;
-        socklen_t client_len = sizeof(client_address);
-        
-		*socket_peer = accept(*socket_listen, (struct sockaddr *)&client_address,
-            &client_len);
-            
-		if (*socket_peer < 0) {
-			perror("Failed to accept client");
-			return *socket_peer;
+		if ((status = accept_player(*socket_listen, socket_peer)) != 0) {
+			return status;
 		}
-		printf("Connection successful\n");
 		
 	} else if (mode == JOIN) {
 		char hostname[HOST_NAME_MAX];
 		char ipstr[INET_ADDRSTRLEN];
 		
-		printf("Enter hostname: ");
-		while (!is_valid_input(scanf("%s", hostname), 1));
+		prompt("Enter hostname: ");
+		while (!is_valid_input(status = input_word(hostname, sizeof(hostname)), 1));
+		if (status == INPUT_END) {
+			log_write(LOG_ERROR, "input", "End of input before the game started");
+			return 1;
+		}
         // Find IP address of host
         if ((status = hostname_to_ip(hostname, ipstr))) {
 			return status;
 		}
-		printf("Host found at: %s\n", ipstr);
-        
-        struct addrinfo hints;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
+		log_write(chatter_level(), "connect", "Host found at: %s", ipstr);
         
-        struct addrinfo *peer_address;
-        
-        if ((status = getaddrinfo(ipstr, PORT, &hints, &peer_address))) {
-            fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
-            return status;
-        }
-        
-		*socket_peer = socket(peer_address->ai_family, 
-            peer_address->ai_socktype, peer_address->ai_protocol);
-        
-		if (*socket_peer < 0) {
-			perror("Failed to create socket");
-            return *socket_peer;
-		}
-		printf("Socket created\n");
-		
-		// Connect to host
-		if ((status = connect(*socket_peer, peer_address->ai_addr, 
-                peer_address->ai_addrlen) < 0)) {
-			perror("Connect failed. Error");
+		if ((status = join_host(ipstr, socket_peer)) != 0) {
 			return status;
 		}
-        // Free resources
-        freeaddrinfo(peer_address);
-		printf("Connected to host\n");
+		// Remember host in case we have to reconnect
+		memcpy(host_ip, ipstr, INET_ADDRSTRLEN);
+		log_fields("host=%s", ipstr);
+		log_write(chatter_level(), "connect", "Connected to host");
 	}
+	TRACE_END("connect_players", t_connect);
 	return 0;
 }
 
+// PRE: Static name of the event and what recv_full returned short of a full
+//      message
+// POST: Orderly close by the peer or the receive error logged
+static void log_recv_failure(const char *event, const int bytes) {
+	if (bytes == 0) {
+		log_write(LOG_WARN, "peer_closed", "Opponent closed the connection");
+	} else {
+		log_errno(event, "Receive failed");
+	}
+}
+
+// PRE: Socket of peer and number of seconds
+// POST: Receiving from the peer fails after waiting that long
+void set_peer_timeout(const int socket_peer, const int seconds) {
+	const struct timeval timeout = {seconds, 0};
+	setsockopt(socket_peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
 // PRE: Send 'send buffer' to opponent and receive opponent buffer in
 //      Receive buffer
 // POST: 0 on success 1 on error/shutdown
 int sendrecv(const int socket_peer, const void *send_buf, 
         const void *recv_buf, int message_size, enum MODE mode) {
+	TRACE_BEGIN(t_sendrecv);
+	int status = 1;
+	log_fields("bytes=%d", message_size);
 	if (mode == HOST) {
-		printf("Sending to opponent...\n");
+		log_write(chatter_level(), "sendrecv", "Sending to opponent...");
 		if (send_full(socket_peer, send_buf, message_size) < 0) {
-			perror("Send failed");
-			return 1;
+			log_errno("sendrecv", "Send failed");
+			goto done;
 		}
-		printf("Waiting for opponent...\n");
-		if (recv_full(socket_peer, recv_buf, message_size) <= 0) {
-			perror("Recv failed");
-			return 1;
+		log_write(chatter_level(), "sendrecv", "Waiting for opponent...");
+		const int bytes_recv = recv_full(socket_peer, recv_buf, message_size);
+		if (bytes_recv <= 0) {
+			log_recv_failure("sendrecv", bytes_recv);
+			goto done;
 		}
 	} else {
-		printf("Sending to opponent...\n");
+		log_write(chatter_level(), "sendrecv", "Sending to opponent...");
 		if (send_full(socket_peer, send_buf, message_size) < 0) {
-			perror("Send failed");
-			return 1;
+			log_errno("sendrecv", "Send failed");
+			goto done;
 		}
-		printf("Waiting for opponent...\n");
-		if (recv_full(socket_peer, recv_buf, message_size) <= 0) {
-			perror("Receive failed");
-			return 1;
+		log_write(chatter_level(), "sendrecv", "Waiting for opponent...");
+		const int bytes_recv = recv_full(socket_peer, recv_buf, message_size);
+		if (bytes_recv <= 0) {
+			log_recv_failure("sendrecv", bytes_recv);
+			goto done;
 		}
 	}
+	status = 0;
+
+done:
+	TRACE_END("sendrecv", t_sendrecv);
+	return status;
+}
+
+// PRE: Session of a running game and shot of the player: valid
+//      coordinates already applied with shoot(), or FORFEIT
+// POST: Shot recorded and sent; returns 1 on error and 0 otherwise
+static int send_shot(const int socket_peer, struct session *s, const int row,
+                     const int col, const int is_hit, const uint64_t turn_start) {
+	if (row != FORFEIT) {
+		snapshot_shot(s, SELF, (row - 1) * BOARD_LENGTH + col - 1);
+		print_results(row, col, is_hit, SELF);
+	}
+	s->coords[SELF][0] = row;
+	s->coords[SELF][1] = col;
+	// Send shoot coordinates to opponent
+	TRACE_BEGIN(t_send);
+	const int bytes_sent = send_full(socket_peer, s->coords[SELF], sizeof(s->coords[SELF]));
+	TRACE_END("send", t_send);
+	if (bytes_sent < 0) {
+		log_errno("send", "Send failed");
+		return 1;
+	}
+	metrics_add(METRIC_TURNS, 1);
+	metrics_observe(HISTOGRAM_TURN, turn_start);
 	return 0;
 }
 
-// PRE: Exchange shots between player and opponent
-// POST: Returns 1 on error and 0 otherwise
-int exchange_shots(const int socket_peer, int coord_size, 
-                   int *player_coords, char *player_board, const int *player_map, 
-                   struct ship_t *player_ships, int *player_ship_count, 
-                   int *opponent_coords, char *opponent_board, const int *opponent_map,
-                   struct ship_t *opponent_ships, int *opponent_ship_count,
-                   enum MODE mode) {
-    int row, col;
-    int opp_row, opp_col;
-    int is_hit;
-    
-	if (mode == HOST) {
-		printf("Waiting for opponent's move...\n");
-		if (recv_full(socket_peer, opponent_coords, coord_size) <= 0) {
-			perror("Target recv failed");
-			return 1;
+// PRE: Session of a running game whose player has input waiting
+// POST: Coordinates read and, if valid, the shot fired; coordinates typed
+//       only partly are left for the next call; returns 1 on error and 0
+//       otherwise, fired set if the shot was sent
+static int fire_shot(const int socket_peer, struct session *s,
+                     const uint64_t turn_start, int *fired) {
+	int row, col;
+	TRACE_BEGIN(t_input);
+	input_set_deadline(now_ns());  // only what was typed so far
+	const int given = read_coords(&row, &col);
+	input_set_deadline(0);
+	TRACE_END("input", t_input);
+	if (given == INPUT_TIMEOUT) {
+		return 0;  // rest of the shot not typed yet, back to waiting
+	}
+	if (given == INPUT_END) {
+		// Nobody is left to shoot; the round ends and the game with it
+		log_write(chatter_level(), "forfeit", "End of input, you forfeit");
+		*fired = 1;
+		return send_shot(socket_peer, s, FORFEIT, FORFEIT, 0, turn_start);
+	}
+	// Shoot opponent board
+	TRACE_BEGIN(t_shoot);
+	const int is_hit = shoot(row, col, s->board[OPPONENT], s->map[OPPONENT],
+	                         &s->ship_count[OPPONENT], s->ships[OPPONENT], OPPONENT);
+	TRACE_END("shoot", t_shoot);
+	if (is_hit == -1) {
+		prompt("Invalid coordinates, try again: ");
+		return 0;
+	}
+	*fired = 1;
+	return send_shot(socket_peer, s, row, col, is_hit, turn_start);
+}
+
+// PRE: Session of a running game whose player ran out of time for a turn
+// POST: Bot fired in the player's place; returns 1 on error and 0 otherwise
+static int fire_auto_shot(const int socket_peer, struct session *s,
+                          const uint64_t turn_start) {
+	struct bot b;
+	bot_observe_board(&b, s->board[OPPONENT], s->map[OPPONENT], s->ships[OPPONENT]);
+	const int index = bot_choose(&b);
+	const int row = index / BOARD_LENGTH + 1;
+	const int col = index % BOARD_LENGTH + 1;
+	log_write(LOG_INFO, "timeout", "Out of time, shooting for you");
+	const int is_hit = shoot(row, col, s->board[OPPONENT], s->map[OPPONENT],
+	                         &s->ship_count[OPPONENT], s->ships[OPPONENT], OPPONENT);
+	return send_shot(socket_peer, s, row, col, is_hit, turn_start);
+}
+
+// PRE: Session of a running game with (part of) a shot of the opponent
+//      waiting
+// POST: What arrived of the shot taken without waiting for the rest; once
+//       complete, applied to own board and received set; returns 1 on
+//       error and 0 otherwise
+static int receive_shot(const int socket_peer, struct session *s,
+                        const uint64_t turn_start, int *received) {
+	const int size = sizeof(s->coords[OPPONENT]);
+	TRACE_BEGIN(t_recv);
+	const ssize_t bytes = recv(socket_peer, s->buf[OPPONENT] + s->buf_len[OPPONENT],
+	                           size - s->buf_len[OPPONENT], MSG_DONTWAIT);
+	TRACE_END("recv", t_recv);
+	if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	}
+	if (bytes <= 0) {
+		metrics_add((bytes == 0) ? METRIC_ERROR_DISCONNECT : METRIC_ERROR_RECV, 1);
+		log_recv_failure("recv", bytes);
+		return 1;
+	}
+	metrics_add(METRIC_BYTES_RECEIVED, bytes);
+	s->buf_len[OPPONENT] += bytes;
+	if (s->buf_len[OPPONENT] < size) {
+		return 0;  // rest of the shot still on its way, back to waiting
+	}
+	memcpy(s->coords[OPPONENT], s->buf[OPPONENT], size);
+	*received = 1;
+	metrics_add(METRIC_TURNS, 1);
+	metrics_observe(HISTOGRAM_TURN, turn_start);
+	const int opp_row = s->coords[OPPONENT][0];
+	const int opp_col = s->coords[OPPONENT][1];
+	if (opp_row == FORFEIT) {
+		log_write(LOG_INFO, "forfeit", "Opponent forfeits");
+		return 0;
+	}
+	// Shoot own board
+	TRACE_BEGIN(t_shoot);
+	const int is_hit = shoot(opp_row, opp_col, s->board[SELF], s->map[SELF],
+	                         &s->ship_count[SELF], s->ships[SELF], SELF);
+	TRACE_END("shoot", t_shoot);
+	if (is_hit != -1) {
+		snapshot_shot(s, OPPONENT, (opp_row - 1) * BOARD_LENGTH + opp_col - 1);
+	} else {
+		metrics_add(METRIC_ERROR_RULES, 1);
+	}
+	// Print results
+	print_results(opp_row, opp_col, is_hit, OPPONENT);
+	return 0;
+}
+
+// PRE: Exchange shots between player and opponent of session
+// POST: Both shots of a round exchanged, whichever comes first; a player
+//       too slow for TURN_LIMIT_S gets a shot by the bot, one out of game
+//       time forfeits, and an opponent not heard from in time forfeits
+//       and ends the session (closing); returns 1 on error and 0 otherwise
+int exchange_shots(const int socket_peer, struct session *s) {
+	const uint64_t turn_start = now_ns();
+	const uint64_t turn_limit = (uint64_t)TURN_LIMIT_S * 1000000000u;
+	const uint64_t peer_limit = (uint64_t)(TURN_LIMIT_S + PEER_GRACE_S) * 1000000000u;
+	// Player's turn ends with the turn limit or the game clock, whatever is first
+	const uint64_t fire_deadline = turn_start +
+	    ((s->time_left < turn_limit) ? s->time_left : turn_limit);
+	int fired = 0, received = 0, charged = 0;
+	s->buf_len[OPPONENT] = 0;  // opponent's shot, collected as it arrives
+
+	prompt("Enter shoot coords: ");
+	while (!fired || !received) {
+		struct pollfd fds[2] = {
+			{fired ? -1 : input_source(), POLLIN, 0},
+			{received ? -1 : socket_peer, POLLIN, 0}
+		};
+		// Wait until input, the opponent's shot or the nearest deadline
+		const uint64_t now = now_ns();
+		uint64_t deadline = fired ? turn_start + peer_limit : fire_deadline;
+		if (!received && turn_start + peer_limit < deadline) {
+			deadline = turn_start + peer_limit;
 		}
-		opp_row = opponent_coords[0]; opp_col = opponent_coords[1];
-		// Shoot own board
-		is_hit = shoot(opp_row, opp_col, player_board, player_map, 
-		               player_ship_count, player_ships, SELF);
-		// Print results
-		print_results(opp_row, opp_col, is_hit, OPPONENT);
-	
-		printf("Enter shoot coords: ");
-		while(!is_valid_input(scanf("%d %d", &row, &col), 2));
-		// Shoot opponent board
-		while((is_hit = shoot(row, col, opponent_board, opponent_map,
-		                      opponent_ship_count, opponent_ships, OPPONENT)) == -1) {
-			printf("Invalid coordinates, try again: ");
-			while(!is_valid_input(scanf("%d %d", &row, &col), 2));
+		int timeout_ms = (deadline > now) ? (int)((deadline - now) / 1000000u) + 1 : 0;
+		if (!fired && input_buffered()) {
+			timeout_ms = 0;
 		}
-		player_coords[0] = row;
-		player_coords[1] = col;
-		// Print results
-		print_results(row, col, is_hit, SELF);
-		// Send shoot coordinates to opponent
-		if (send_full(socket_peer, player_coords, coord_size) < 0) {
-			perror("Send failed");
+		TRACE_BEGIN(t_wait);
+		if (poll(fds, 2, timeout_ms) < 0 && errno != EINTR) {
+			log_errno("poll", "Poll failed");
 			return 1;
 		}
-	} else {  // Client shoots first			
-		printf("Enter shoot coords: ");
-		while(!is_valid_input(scanf("%d %d", &row, &col), 2));
-		// Shoot opponent board
-		while((is_hit = shoot(row, col, opponent_board, opponent_map,
-		                      opponent_ship_count, opponent_ships, OPPONENT)) == -1) {
-			printf("Invalid coordinates, try again: ");
-			while(!is_valid_input(scanf("%d %d", &row, &col), 2));
+		// Time spent on the player or the opponent, whoever woke us up or,
+		// on a deadline, whoever we were still waiting for
+		TRACE_END((fds[0].revents != 0 || (fds[1].revents == 0 && !fired))
+		          ? "wait_input" : "wait_peer", t_wait);
+
+		if (!received && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+			if (receive_shot(socket_peer, s, turn_start, &received) != 0) {
+				return 1;
+			}
+			if (received && !fired) {
+				prompt("Enter shoot coords: ");  // shot of opponent came in between
+			}
+		} else if (!received && now_ns() >= turn_start + peer_limit) {
+			// Opponent is gone without closing the connection
+			log_write(LOG_INFO, "timeout", "Opponent did not move in time and forfeits");
+			s->ship_count[OPPONENT] = 0;
+			s->closing = 1;
+			return 0;
 		}
-		player_coords[0] = row;
-		player_coords[1] = col;
-		// Print results
-		print_results(row, col, is_hit, SELF);
-		// Send shoot coordinates to opponent
-		if (send_full(socket_peer, player_coords, coord_size) < 0) {
-			perror("Send failed");
-			return 1;
+
+		if (!fired && ((fds[0].revents & (POLLIN | POLLHUP)) || input_buffered())) {
+			if (fire_shot(socket_peer, s, turn_start, &fired) != 0) {
+				return 1;
+			}
+		} else if (!fired && now_ns() >= fire_deadline) {
+			fired = 1;
+			if (s->time_left <= turn_limit) {
+				log_write(LOG_INFO, "forfeit", "Out of game time, you forfeit");
+				if (send_shot(socket_peer, s, FORFEIT, FORFEIT, 0, turn_start) != 0) {
+					return 1;
+				}
+			} else if (fire_auto_shot(socket_peer, s, turn_start) != 0) {
+				return 1;
+			}
 		}
-		printf("Waiting for opponent's move...\n");
-		if (recv_full(socket_peer, opponent_coords, coord_size) <= 0) {
-			perror("Target recv failed");
+		if (fired && !charged) {
+			// Charge the player's clock once the shot is out
+			const uint64_t used = now_ns() - turn_start;
+			s->time_left = (used < s->time_left) ? s->time_left - used : 0;
+			charged = 1;
+		}
+	}
+	// Forfeits count once the round is complete, so both sides stay in step
+	if (s->coords[SELF][0] == FORFEIT) {
+		s->ship_count[SELF] = 0;
+	}
+	if (s->coords[OPPONENT][0] == FORFEIT) {
+		s->ship_count[OPPONENT] = 0;
+	}
+	return 0;
+}
+
+// PRE: Listening socket (host only) after the connection to the peer was
+//      closed
+// POST: Same peer connected again within RESUME_TIMEOUT_S seconds;
+//       returns 0 on success, 1 otherwise
+int reconnect_players(const int socket_listen, int *socket_peer, enum MODE mode) {
+	if (mode == HOST) {
+		log_write(LOG_WARN, "reconnect", "Waiting for opponent to reconnect...");
+		struct pollfd fd = {socket_listen, POLLIN, 0};
+		if (poll(&fd, 1, RESUME_TIMEOUT_S * 1000) <= 0) {
 			return 1;
 		}
-		opp_row = opponent_coords[0]; opp_col = opponent_coords[1];
-		// Shoot own board
-		is_hit = shoot(opp_row, opp_col, player_board, player_map,
-		               player_ship_count, player_ships, SELF);
-		// Print results
-		print_results(opp_row, opp_col, is_hit, OPPONENT);
+		return accept_player(socket_listen, socket_peer);
+	}
+	log_write(LOG_WARN, "reconnect", "Reconnecting to host...");
+	int attempt;
+	for (attempt = 0; attempt < RESUME_TIMEOUT_S; ++attempt) {
+		if (join_host(host_ip, socket_peer) == 0) {
+			return 0;
+		}
+		sleep(1);
+	}
+	return 1;
+}
+
+// PRE: Session whose connection broke during the game, listening socket
+//      (host only)
+// POST: Peer reconnected, both sides agreed on the last turn they completed
+//       and the session was rolled back to it; returns 0 on success,
+//       1 otherwise
+int resume_game(const int socket_listen, int *socket_peer, struct session *s,
+                enum MODE mode) {
+	close(*socket_peer);
+	*socket_peer = -1;
+	if (reconnect_players(socket_listen, socket_peer, mode) != 0) {
+		return 1;
+	}
+	// One message each way: how far we got and which game we are in
+	struct resume_msg mine, theirs;
+	mine.turn = snapshot_turn(s);
+	mine.checksum = snapshot_checksum(s);
+	set_peer_timeout(*socket_peer, RESUME_TIMEOUT_S);
+	if (sendrecv(*socket_peer, &mine, &theirs, sizeof(mine), mode) != 0) {
+		return 1;
+	}
+	set_peer_timeout(*socket_peer, GAME_LIMIT_S);
+	if (theirs.checksum != mine.checksum) {
+		log_write(LOG_ERROR, "resume", "Reconnected player is not part of this game");
+		return 1;
 	}
+	const int turn = (theirs.turn < mine.turn) ? theirs.turn : mine.turn;
+	snapshot_restore(s, turn);
+	log_fields("turn=%d", turn);
+	log_write(LOG_INFO, "resume", "Game resumed after turn %d", turn);
 	return 0;
 }
@@ -0,0 +1,312 @@
+#include "clock.h"
+#include "engine.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// PRE: Engine, events to wait for on its requests (0 for none) and
+//      deadline of the batch
+// POST: Waited until the requests are ready for those events or replies
+//       arrived, which are added to the buffer; returns 0 then, 1 once the
+//       deadline passed or the engine is gone
+static int wait_engine(struct engine *e, const short events, const uint64_t deadline) {
+	// Keep the partial line at the start and read more behind it
+	memmove(e->in, e->in + e->in_pos, e->in_len - e->in_pos);
+	e->in_len -= e->in_pos;
+	e->in_pos = 0;
+	for (;;) {
+		// Replies are taken while writing too, so an engine answering early
+		// never waits for us to read while we wait for it to read
+		struct pollfd fds[2] = {
+			{e->fd_in, (e->in_len < ENGINE_BUFFER_SIZE) ? POLLIN : 0, 0},
+			{(events != 0) ? e->fd_out : -1, events, 0}
+		};
+		const uint64_t now = now_ns();
+		const int timeout_ms = (deadline > now) ? (int)((deadline - now) / 1000000u) + 1 : 0;
+		const int ready = poll(fds, 2, timeout_ms);
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ready <= 0) {
+			log_write(LOG_ERROR, "engine", "Engine %s did not answer in time", e->name);
+			return 1;
+		}
+		if (fds[0].revents != 0) {
+			const ssize_t bytes = read(e->fd_in, e->in + e->in_len, ENGINE_BUFFER_SIZE - e->in_len);
+			if (bytes < 0 && (errno == EINTR || errno == EAGAIN)) {
+				continue;
+			}
+			if (bytes <= 0) {
+				log_write(LOG_ERROR, "engine", "Engine %s is gone", e->name);
+				return 1;
+			}
+			e->in_len += bytes;
+			if (events == 0) {
+				return 0;
+			}
+		}
+		if (fds[1].revents != 0) {
+			return 0;  // ready to write, or the write reports the error
+		}
+	}
+}
+
+// PRE: Engine with requests in its buffer
+// POST: Requests written; failed set on error or once the batch ran out of
+//       time
+static void flush_requests(struct engine *e) {
+	const uint64_t deadline = e->batch_start + (uint64_t)ENGINE_TIMEOUT_S * 1000000000u;
+	int offset = 0;
+	while (!e->failed && offset < e->out_len) {
+		const ssize_t bytes = write(e->fd_out, e->out + offset, e->out_len - offset);
+		if (bytes > 0) {
+			offset += bytes;
+			continue;
+		}
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytes < 0 && errno != EAGAIN) {
+			log_errno("engine", "Engine write failed");
+			e->failed = 1;
+			break;
+		}
+		// The engine has not read what it got so far
+		if (wait_engine(e, POLLOUT, deadline) != 0) {
+			e->failed = 1;
+		}
+	}
+	e->out_len = 0;
+}
+
+// PRE: Engine and buffer for a line
+// POST: Next line without its newline, cut to fit the buffer; returns 0
+//       on success, 1 on error or once the batch ran out of time
+static int read_line(struct engine *e, char *line, const int size) {
+	const uint64_t deadline = e->batch_start + (uint64_t)ENGINE_TIMEOUT_S * 1000000000u;
+	for (;;) {
+		char *end = memchr(e->in + e->in_pos, '\n', e->in_len - e->in_pos);
+		if (end != NULL) {
+			*end = '\0';
+			snprintf(line, size, "%s", e->in + e->in_pos);
+			e->in_pos = end + 1 - e->in;
+			return 0;
+		}
+		if (e->in_pos == 0 && e->in_len == ENGINE_BUFFER_SIZE) {
+			log_write(LOG_ERROR, "engine", "Engine %s sent a line that is too long", e->name);
+			return 1;
+		}
+		if (wait_engine(e, 0, deadline) != 0) {
+			return 1;
+		}
+	}
+}
+
+// PRE: Engine and command line
+// POST: Engine started by the shell, talking over pipes on its standard
+//       input and output; returns 0 on success, 1 otherwise
+static int spawn_engine(struct engine *e, const char *command) {
+	int requests[2], replies[2];
+	if (pipe(requests) != 0) {
+		log_errno("engine", "Could not create pipe");
+		return 1;
+	}
+	if (pipe(replies) != 0) {
+		log_errno("engine", "Could not create pipe");
+		close(requests[0]);
+		close(requests[1]);
+		return 1;
+	}
+	e->pid = fork();
+	if (e->pid < 0) {
+		log_errno("engine", "Could not start engine");
+		close(requests[0]);
+		close(requests[1]);
+		close(replies[0]);
+		close(replies[1]);
+		return 1;
+	}
+	if (e->pid == 0) {
+		setpgid(0, 0);  // the shell and whatever it starts are killed together
+		dup2(requests[0], STDIN_FILENO);
+		dup2(replies[1], STDOUT_FILENO);
+		close(requests[0]);
+		close(requests[1]);
+		close(replies[0]);
+		close(replies[1]);
+		execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+		_exit(127);
+	}
+	setpgid(e->pid, e->pid);  // also here, in case the child has not yet
+	close(requests[0]);
+	close(replies[1]);
+	// Engines started later must not hold on to this one's pipes
+	fcntl(requests[1], F_SETFD, FD_CLOEXEC);
+	fcntl(replies[0], F_SETFD, FD_CLOEXEC);
+	e->fd_out = requests[1];
+	e->fd_in = replies[0];
+	return 0;
+}
+
+// PRE: Engine and path of the socket it listens on
+// POST: Connected to engine; returns 0 on success, 1 otherwise
+static int connect_engine(struct engine *e, const char *path) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		log_write(LOG_ERROR, "engine", "Engine socket path is too long");
+		return 1;
+	}
+	strcpy(address.sun_path, path);
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		log_errno("engine", "Could not create socket");
+		return 1;
+	}
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		log_errno("engine", "Could not connect to engine");
+		close(fd);
+		return 1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	e->fd_in = fd;
+	e->fd_out = fd;
+	return 0;
+}
+
+// PRE: Engine and either a command line to start it with or
+//      ENGINE_SOCKET_PREFIX followed by the path of its socket
+// POST: Engine started or connected and greeted; returns 0 on success,
+//       1 otherwise
+int engine_open(struct engine *e, const char *spec) {
+	snprintf(e->name, ENGINE_NAME_SIZE, "%s", spec);
+	e->fd_in = -1;
+	e->fd_out = -1;
+	e->pid = -1;
+	e->out_len = 0;
+	e->in_pos = 0;
+	e->in_len = 0;
+	e->failed = 0;
+	e->batch_open = 0;
+	e->busy_ns = 0;
+	e->batches = 0;
+
+	const size_t prefix = strlen(ENGINE_SOCKET_PREFIX);
+	const int status = (strncmp(spec, ENGINE_SOCKET_PREFIX, prefix) == 0)
+	    ? connect_engine(e, spec + prefix) : spawn_engine(e, spec);
+	if (status != 0) {
+		return 1;
+	}
+	// Writes wait for the engine with a deadline instead of blocking
+	fcntl(e->fd_out, F_SETFL, fcntl(e->fd_out, F_GETFL) | O_NONBLOCK);
+
+	// Greet the engine and learn its name
+	char line[ENGINE_LINE_SIZE], name[ENGINE_NAME_SIZE];
+	engine_request(e, "battle %d", ENGINE_PROTOCOL_VERSION);
+	flush_requests(e);
+	if (e->failed || read_line(e, line, sizeof(line)) != 0) {
+		e->failed = 1;
+		return 1;
+	}
+	e->batch_open = 0;
+	if (sscanf(line, "ready %31s", name) != 1) {
+		log_write(LOG_ERROR, "engine", "Engine %s does not speak the protocol", e->name);
+		e->failed = 1;
+		return 1;
+	}
+	snprintf(e->name, ENGINE_NAME_SIZE, "%s", name);
+	return 0;
+}
+
+// PRE: Open engine, printf-style request without newline
+// POST: Request added to the current batch
+void engine_request(struct engine *e, const char *format, ...) {
+	if (!e->batch_open) {
+		// The clock of a batch starts with its first request
+		e->batch_start = now_ns();
+		e->batch_open = 1;
+	}
+	if (ENGINE_BUFFER_SIZE - e->out_len < ENGINE_LINE_SIZE) {
+		flush_requests(e);
+	}
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(e->out + e->out_len, ENGINE_LINE_SIZE - 1, format, args);
+	va_end(args);
+	if (len > ENGINE_LINE_SIZE - 2) {
+		len = ENGINE_LINE_SIZE - 2;  // cut like any other long line
+	}
+	e->out_len += len;
+	e->out[e->out_len++] = '\n';
+}
+
+// PRE: Open engine with a batch of requests
+// POST: Batch closed with go and written; returns 0 on success, 1 otherwise
+int engine_go(struct engine *e) {
+	engine_request(e, "go");
+	flush_requests(e);
+	return e->failed;
+}
+
+// PRE: Open engine after engine_go and buffer for a line
+// POST: Next reply of the batch read; returns 0 for a reply, 1 once the
+//       batch is done and -1 on error or after ENGINE_TIMEOUT_S
+int engine_reply(struct engine *e, char *line, const int size) {
+	if (e->failed || read_line(e, line, size) != 0) {
+		e->failed = 1;
+		return -1;
+	}
+	if (strcmp(line, "done") == 0) {
+		e->busy_ns += now_ns() - e->batch_start;
+		e->batches++;
+		e->batch_open = 0;
+		return 1;
+	}
+	return 0;
+}
+
+// PRE: Engine opened with engine_open (successfully or not)
+// POST: Engine told to quit, connection closed and process reaped; one
+//       still running after ENGINE_TIMEOUT_S is killed
+void engine_close(struct engine *e) {
+	if (e->fd_out >= 0 && !e->failed) {
+		engine_request(e, "quit");
+		flush_requests(e);
+	}
+	if (e->fd_out >= 0) {
+		close(e->fd_out);
+	}
+	if (e->fd_in >= 0 && e->fd_in != e->fd_out) {
+		close(e->fd_in);
+	}
+	e->fd_in = -1;
+	e->fd_out = -1;
+	if (e->pid > 0) {
+		// An engine that broke the protocol may not listen to quit, and one
+		// that did not gets ENGINE_TIMEOUT_S to do so
+		const uint64_t deadline = now_ns() + (uint64_t)ENGINE_TIMEOUT_S * 1000000000u;
+		const struct timespec interval = {0, ENGINE_REAP_MS * 1000000L};
+		pid_t reaped = 0;
+		while (!e->failed && (reaped = waitpid(e->pid, NULL, WNOHANG)) == 0 &&
+		       now_ns() < deadline) {
+			nanosleep(&interval, NULL);
+		}
+		if (reaped == 0) {  // still running
+			kill(-e->pid, SIGKILL);
+			while (waitpid(e->pid, NULL, 0) < 0 && errno == EINTR);
+		}
+		e->pid = -1;
+	}
+}
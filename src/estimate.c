@@ -0,0 +1,360 @@
+#include "bot.h"  // enum CELL
+#include "clock.h"
+#include "estimate.h"
+#include "input.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Everything a playout needs, shared read-only by all workers apart from
+// the tallies
+struct estimate_job {
+	// What the player has seen of the opponent board
+	unsigned char opponent_view[BOARD_SIZE];
+	int sunk_fleet[BOARD_SIZE];  // ship id on cells of sunk ships, -1 elsewhere
+	int afloat[NUM_SHIPS];       // ids of opponent ships not sunk yet
+	int num_afloat;
+	// What the opponent has seen of the player's board, and the real fleet
+	unsigned char player_view[BOARD_SIZE];
+	const int *player_fleet;
+	uint64_t deadline;
+	atomic_int wins;
+	atomic_int draws;
+	atomic_int losses;
+	atomic_int stop;
+};
+
+struct estimate_worker {
+	pthread_t thread;
+	struct estimate_job *job;
+	unsigned int seed;
+};
+
+// PRE: Board as drawn, ship map and ships of the side it belongs to
+// POST: What the other side knows about every cell; cells of sunk ships
+//       are revealed
+static void observe_board(const char *board, const int *map,
+                          const struct ship_t *ships, unsigned char *view) {
+	int i;
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		if (board[i] == HIT) {
+			const int id = map[i];
+			view[i] = (ships[id].hits_taken == ships[id].length) ? CELL_SUNK : CELL_HIT;
+		} else {
+			view[i] = (board[i] == MISS) ? CELL_MISS : CELL_UNKNOWN;
+		}
+	}
+}
+
+// PRE: Job, fleet sampled so far, ship and origin and step of its cells
+// POST: 1 if the ship fits there given the player's view, 0 otherwise
+static int fits(const struct estimate_job *job, const int *fleet, const int id,
+                const int origin, const int step) {
+	int k;
+	for (k = 0; k < player_ships[id].length; ++k) {
+		const int cell = origin + k * step;
+		if (fleet[cell] >= 0 || job->opponent_view[cell] == CELL_MISS ||
+		    job->opponent_view[cell] == CELL_SUNK) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// PRE: Job, fleet sampled so far, ships not placed yet and a cell, or -1
+//      for any cell
+// POST: Returns the number of places a ship fits that cover the cell; one
+//       of them picked uniformly is stored as index in unplaced, origin
+//       and step
+static int pick_placement(const struct estimate_job *job, const int *fleet,
+                          const int *unplaced, const int num_unplaced, const int cell,
+                          int *id, int *origin, int *step, unsigned int *seed) {
+	int count = 0;
+	int i, vertical, r, c, k;
+	for (i = 0; i < num_unplaced; ++i) {
+		const int length = player_ships[unplaced[i]].length;
+		for (vertical = 0; vertical < 2; ++vertical) {
+			const int stride = vertical ? BOARD_LENGTH : 1;
+			for (r = 0; r < BOARD_LENGTH - vertical * (length - 1); ++r) {
+				for (c = 0; c < BOARD_LENGTH - !vertical * (length - 1); ++c) {
+					const int o = r * BOARD_LENGTH + c;
+					for (k = 0; cell >= 0 && k < length && o + k * stride != cell; ++k);
+					if (k == length || !fits(job, fleet, unplaced[i], o, stride)) {
+						continue;  // does not cover the cell or does not fit
+					}
+					// Reservoir sampling keeps every placement equally likely
+					if (rand_r(seed) % ++count == 0) {
+						*id = i;
+						*origin = o;
+						*step = stride;
+					}
+				}
+			}
+		}
+	}
+	return count;
+}
+
+// PRE: Job, fleet to fill in and the time to give up at
+// POST: Ships still afloat placed at random where they could lie given the
+//       player's view: first one over every unresolved hit, then the rest
+//       anywhere they fit; returns 0 on success, 1 if no consistent fleet
+//       was found in time
+static int sample_fleet(const struct estimate_job *job, int *fleet, unsigned int *seed) {
+	int attempt, i, k;
+	for (attempt = 0; attempt < ESTIMATE_SAMPLE_TRIES; ++attempt) {
+		if (now_ns() >= job->deadline) {
+			return 1;
+		}
+		int unplaced[NUM_SHIPS];
+		int num_unplaced = job->num_afloat;
+		memcpy(unplaced, job->afloat, sizeof(unplaced));
+		memcpy(fleet, job->sunk_fleet, sizeof(job->sunk_fleet));
+		// Hits in random order, each covered by some ship unless one already is
+		int hits[BOARD_SIZE], num_hits = 0;
+		for (k = 0; k < BOARD_SIZE; ++k) {
+			if (job->opponent_view[k] == CELL_HIT) {
+				hits[num_hits++] = k;
+			}
+		}
+		int failed = 0;
+		while (num_unplaced > 0) {
+			int cell = -1;
+			while (cell < 0 && num_hits > 0) {
+				const int h = rand_r(seed) % num_hits;
+				cell = (fleet[hits[h]] < 0) ? hits[h] : -1;
+				hits[h] = hits[--num_hits];
+			}
+			int index = 0, origin = 0, step = 1;
+			if (pick_placement(job, fleet, unplaced, num_unplaced, cell,
+			                   &index, &origin, &step, seed) == 0) {
+				failed = 1;
+				break;
+			}
+			const int id = unplaced[index];
+			for (k = 0; k < player_ships[id].length; ++k) {
+				fleet[origin + k * step] = id;
+			}
+			unplaced[index] = unplaced[--num_unplaced];
+		}
+		if (failed) {
+			continue;
+		}
+		// Every hit seen must be part of a ship
+		for (i = 0; i < num_hits; ++i) {
+			if (fleet[hits[i]] < 0) {
+				break;
+			}
+		}
+		if (i == num_hits) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// PRE: Stack of cells to try next and a cell that was hit
+// POST: Unknown neighbours of cell pushed
+static void push_neighbours(const unsigned char *cells, int *targets, int *num_targets,
+                            const int index) {
+	const int r = index / BOARD_LENGTH;
+	const int c = index % BOARD_LENGTH;
+	if (r > 0 && cells[index - BOARD_LENGTH] == CELL_UNKNOWN) {
+		targets[(*num_targets)++] = index - BOARD_LENGTH;
+	}
+	if (r < BOARD_LENGTH - 1 && cells[index + BOARD_LENGTH] == CELL_UNKNOWN) {
+		targets[(*num_targets)++] = index + BOARD_LENGTH;
+	}
+	if (c > 0 && cells[index - 1] == CELL_UNKNOWN) {
+		targets[(*num_targets)++] = index - 1;
+	}
+	if (c < BOARD_LENGTH - 1 && cells[index + 1] == CELL_UNKNOWN) {
+		targets[(*num_targets)++] = index + 1;
+	}
+}
+
+// PRE: What the shooter knows about a board and the fleet really on it
+// POST: Number of shots the shooter needs to sink the rest of the fleet
+//       with the reference hunt/target strategy: neighbours of hits
+//       first, random cells of one colour of the checkerboard otherwise
+static int play_out(const unsigned char *view, const int *fleet, unsigned int *seed) {
+	unsigned char cells[BOARD_SIZE];
+	int hunt[2][BOARD_SIZE / 2], num_hunt[2] = {0, 0};
+	int targets[4 * BOARD_SIZE], num_targets = 0;
+	int remaining = 0;
+	int i;
+
+	memcpy(cells, view, sizeof(cells));
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		if (cells[i] == CELL_UNKNOWN) {
+			const int colour = (i / BOARD_LENGTH + i % BOARD_LENGTH) % 2;
+			hunt[colour][num_hunt[colour]++] = i;
+			remaining += (fleet[i] >= 0);
+		} else if (cells[i] == CELL_HIT) {
+			push_neighbours(cells, targets, &num_targets, i);
+		}
+	}
+
+	int shots = 0;
+	while (remaining > 0) {
+		int index = -1;
+		while (index < 0 && num_targets > 0) {
+			const int t = targets[--num_targets];
+			index = (cells[t] == CELL_UNKNOWN) ? t : -1;
+		}
+		int colour;
+		for (colour = 0; colour < 2 && index < 0; ++colour) {
+			while (index < 0 && num_hunt[colour] > 0) {
+				const int k = rand_r(seed) % num_hunt[colour];
+				const int t = hunt[colour][k];
+				hunt[colour][k] = hunt[colour][--num_hunt[colour]];
+				index = (cells[t] == CELL_UNKNOWN) ? t : -1;
+			}
+		}
+		shots++;
+		if (fleet[index] >= 0) {
+			cells[index] = CELL_HIT;
+			remaining--;
+			push_neighbours(cells, targets, &num_targets, index);
+		} else {
+			cells[index] = CELL_MISS;
+		}
+	}
+	return shots;
+}
+
+// PRE: Tallies of the playouts so far
+// POST: 1 if every chance is known to within ESTIMATE_PRECISION, 0 otherwise
+static int is_precise(const int wins, const int draws, const int losses) {
+	const double n = wins + draws + losses;
+	if (n < ESTIMATE_MIN_PLAYOUTS) {
+		return 0;
+	}
+	const int tallies[3] = {wins, draws, losses};
+	int i;
+	for (i = 0; i < 3; ++i) {
+		const double p = tallies[i] / n;
+		// Standard error below precision, compared squared
+		if (p * (1.0 - p) / n >= ESTIMATE_PRECISION * ESTIMATE_PRECISION) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// PRE: Worker of a job
+// POST: Playouts made in batches until the estimate is precise enough or
+//       the time is up
+static void *run_playouts(void *arg) {
+	struct estimate_worker *w = arg;
+	struct estimate_job *job = w->job;
+	int fleet[BOARD_SIZE];
+
+	while (!atomic_load_explicit(&job->stop, memory_order_relaxed)) {
+		int wins = 0, draws = 0, losses = 0;
+		int i;
+		for (i = 0; i < ESTIMATE_BATCH; ++i) {
+			// A single sample can be slow on a crowded board
+			if (sample_fleet(job, fleet, &w->seed) != 0) {
+				break;
+			}
+			const int player_shots = play_out(job->opponent_view, fleet, &w->seed);
+			const int opponent_shots = play_out(job->player_view, job->player_fleet, &w->seed);
+			// Both fire once per round, so equal shots sink both fleets together
+			wins += (player_shots < opponent_shots);
+			draws += (player_shots == opponent_shots);
+			losses += (player_shots > opponent_shots);
+		}
+		wins += atomic_fetch_add(&job->wins, wins);
+		draws += atomic_fetch_add(&job->draws, draws);
+		losses += atomic_fetch_add(&job->losses, losses);
+		if (is_precise(wins, draws, losses) || now_ns() >= job->deadline) {
+			atomic_store(&job->stop, 1);
+		}
+	}
+	return NULL;
+}
+
+// PRE: Session of a running game (not changed while estimating)
+// POST: Chances estimated by sampling opponent fleets consistent with what
+//       the player has seen and playing both sides out with a hunt/target
+//       strategy on all cores, within ESTIMATE_BUDGET_MS; returns 0 on
+//       success, 1 if fewer than ESTIMATE_MIN_PLAYOUTS could be made in
+//       time (playouts and elapsed_ms are set either way)
+int estimate_win(const struct session *s, struct win_estimate *e) {
+	struct estimate_job job;
+	const uint64_t start = now_ns();
+	int i;
+
+	observe_board(s->board[OPPONENT], s->map[OPPONENT], s->ships[OPPONENT],
+	              job.opponent_view);
+	observe_board(s->board[SELF], s->map[SELF], s->ships[SELF], job.player_view);
+	job.player_fleet = s->map[SELF];
+	// In order of ids, so longest ships (hardest to fit) are placed first
+	job.num_afloat = 0;
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		if (s->ships[OPPONENT][i].hits_taken < s->ships[OPPONENT][i].length) {
+			job.afloat[job.num_afloat++] = i;
+		}
+	}
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		job.sunk_fleet[i] = (job.opponent_view[i] == CELL_SUNK) ? s->map[OPPONENT][i] : -1;
+	}
+	job.deadline = start + ESTIMATE_BUDGET_MS * 1000000u;
+	atomic_init(&job.wins, 0);
+	atomic_init(&job.draws, 0);
+	atomic_init(&job.losses, 0);
+	atomic_init(&job.stop, 0);
+
+	// Use every core; this thread is one of the workers
+	struct estimate_worker workers[ESTIMATE_THREADS_MAX];
+	int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_workers < 1) {
+		num_workers = 1;
+	} else if (num_workers > ESTIMATE_THREADS_MAX) {
+		num_workers = ESTIMATE_THREADS_MAX;
+	}
+	for (i = 0; i < num_workers; ++i) {
+		workers[i].job = &job;
+		workers[i].seed = (unsigned int)(start ^ (i * 2654435761u));
+	}
+	int started;
+	for (started = 1; started < num_workers; ++started) {
+		if (pthread_create(&workers[started].thread, NULL, run_playouts,
+		                   &workers[started]) != 0) {
+			break;
+		}
+	}
+	run_playouts(&workers[0]);
+	for (i = 1; i < started; ++i) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	const int wins = atomic_load(&job.wins);
+	const int draws = atomic_load(&job.draws);
+	const int losses = atomic_load(&job.losses);
+	e->playouts = wins + draws + losses;
+	e->elapsed_ms = (now_ns() - start) / 1e6;
+	if (e->playouts < ESTIMATE_MIN_PLAYOUTS) {
+		return 1;  // too few to mean anything
+	}
+	e->win = (double)wins / e->playouts;
+	e->draw = (double)draws / e->playouts;
+	e->loss = (double)losses / e->playouts;
+	return 0;
+}
+
+// PRE: Session of a running game
+// POST: Estimated chances of both players printed below the boards
+void print_win_estimate(const struct session *s) {
+	struct win_estimate e;
+	if (is_batch() || estimate_win(s, &e) != 0) {
+		return;
+	}
+	printf("Chance to win: you %.1f%%, opponent %.1f%%, draw %.1f%% "
+	       "(%d playouts in %.1f ms)\n", 100.0 * e.win, 100.0 * e.loss,
+	       100.0 * e.draw, e.playouts, e.elapsed_ms);
+}
@@ -0,0 +1,535 @@
+#include "battle.h"
+#include "communicate.h"
+#include "hub.h"
+#include "input.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#define HUB_LINGER_MS (1000)  // time given to flush final messages
+
+// State the hub keeps for every connected player
+struct hub_player {
+	int socket;
+	int connected;
+	int ready;       // fleet received and validated
+	int eliminated;  // elimination already announced
+	int ship_count;
+	char board[BOARD_SIZE];
+	int map[BOARD_SIZE];
+	struct ship_t ships[NUM_SHIPS];
+	// Partially received message
+	char in_buf[FLEET_MESSAGE_SIZE];
+	int in_len;
+	// Pending outgoing messages; head message sent up to out_offset bytes
+	struct hub_msg out[HUB_QUEUE_SIZE];
+	int out_head;
+	int out_len;
+	int out_offset;
+};
+
+static struct hub_player players[FFA_PLAYERS_MAX];
+
+// PRE: Player of the hub
+// POST: 1 if player is still in the game, 0 otherwise
+static int is_alive(const struct hub_player *p) {
+	return p->connected && p->ready && p->ship_count > 0;
+}
+
+// PRE: Player of the hub
+// POST: Closes connection to player
+static void drop_player(struct hub_player *p) {
+	if (p->connected) {
+		close(p->socket);
+		p->connected = 0;
+		p->out_len = 0;
+	}
+}
+
+// PRE: Player of the hub
+// POST: Sends as many pending messages as possible without blocking
+static void flush_player(struct hub_player *p) {
+	while (p->connected && p->out_len > 0) {
+		const char *buf = (const char *)&p->out[p->out_head];
+		const int bytes_sent = send(p->socket, buf + p->out_offset,
+		    sizeof(struct hub_msg) - p->out_offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (bytes_sent < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				drop_player(p);
+			}
+			return;
+		}
+		p->out_offset += bytes_sent;
+		if (p->out_offset == sizeof(struct hub_msg)) {
+			p->out_offset = 0;
+			p->out_head = (p->out_head + 1) % HUB_QUEUE_SIZE;
+			p->out_len--;
+		}
+	}
+}
+
+// PRE: Player of the hub and message to deliver
+// POST: Message queued and sent if socket is writable; players that fall
+//       too far behind are dropped instead of stalling the hub
+static void queue_msg(struct hub_player *p, const struct hub_msg *msg) {
+	if (!p->connected) {
+		return;
+	}
+	if (p->out_len == HUB_QUEUE_SIZE) {
+		fprintf(stderr, "Player not keeping up, dropping\n");
+		drop_player(p);
+		return;
+	}
+	p->out[(p->out_head + p->out_len) % HUB_QUEUE_SIZE] = *msg;
+	p->out_len++;
+	flush_player(p);
+}
+
+// PRE: Number of players and message to deliver
+// POST: Message queued for every connected player
+static void broadcast(const int num_players, const struct hub_msg *msg) {
+	int i;
+	for (i = 0; i < num_players; ++i) {
+		queue_msg(&players[i], msg);
+	}
+}
+
+// PRE: Number of players and player currently on turn (-1 for none)
+// POST: Next player still in the game, -1 if there is none
+static int next_turn(const int num_players, const int current) {
+	int i;
+	for (i = 1; i <= num_players; ++i) {
+		const int id = (current + i + num_players) % num_players;
+		if (is_alive(&players[id])) {
+			return id;
+		}
+	}
+	return -1;
+}
+
+// PRE: Number of players
+// POST: Announces every player that dropped out or lost all ship parts;
+//       returns number of players still in the game
+static int update_eliminations(const int num_players) {
+	int i;
+	int alive = 0;
+	for (i = 0; i < num_players; ++i) {
+		struct hub_player *p = &players[i];
+		if (is_alive(p)) {
+			alive++;
+		} else if (!p->eliminated) {
+			p->eliminated = 1;
+			printf("Player %d eliminated\n", i + 1);
+
+			struct hub_msg msg = {MSG_ELIMINATED, -1, i, 0, 0, 0, -1};
+			broadcast(num_players, &msg);
+		}
+	}
+	return alive;
+}
+
+// PRE: Player that sent a complete fleet message
+// POST: Fleet stored if valid, player dropped otherwise
+static void receive_fleet(struct hub_player *p) {
+	memcpy(p->board, p->in_buf, BOARD_SIZE * sizeof(char));
+	memcpy(p->map, p->in_buf + BOARD_SIZE * sizeof(char),
+	       BOARD_SIZE * sizeof(int));
+
+	if (!is_valid_fleet(p->board, p->map)) {
+		fprintf(stderr, "Received invalid fleet, dropping player\n");
+		drop_player(p);
+		return;
+	}
+	memcpy(p->ships, player_ships, sizeof(p->ships));
+	int i;
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		p->ships[i].hits_taken = 0;
+	}
+	p->ship_count = NUM_SHIP_PARTS;
+	p->ready = 1;
+}
+
+// PRE: Number of players, id of shooter and shot message
+// POST: Shot validated and applied in constant time, result broadcast;
+//       returns 1 if the shot was accepted, 0 otherwise
+static int receive_shot(const int num_players, const int shooter,
+                        const struct hub_msg *shot) {
+	const int target = shot->target;
+	const int r = shot->row - 1;
+	const int c = shot->col - 1;
+
+	if (shot->type != MSG_SHOT || target < 0 || target >= num_players ||
+	    target == shooter || !is_alive(&players[target]) || !is_inside(r, c)) {
+		return 0;
+	}
+	struct hub_player *p = &players[target];
+	int sunk_id;
+	const int is_hit = apply_shot(r * BOARD_LENGTH + c, p->board, p->map,
+	                              &p->ship_count, p->ships, &sunk_id);
+	if (is_hit == -1) {
+		return 0;  // already shot there
+	}
+	printf("Player %d shot player %d: (%d, %d) %s\n", shooter + 1, target + 1,
+	       shot->row, shot->col, is_hit ? "HIT" : "MISS");
+
+	struct hub_msg msg = {MSG_RESULT, shooter, target, shot->row, shot->col,
+	                      is_hit, sunk_id};
+	broadcast(num_players, &msg);
+	return 1;
+}
+
+// PRE: Listening socket and number of players in the game
+// POST: Accepts all players, runs the game until one fleet is left;
+//       returns 0 on success, 1 otherwise
+int run_hub(const int socket_listen, const int num_players) {
+	assert(FFA_PLAYERS_MIN <= num_players && num_players <= FFA_PLAYERS_MAX);
+
+	int i;
+	memset(players, 0, sizeof(players));
+
+	// Lobby: wait until every seat is taken
+	for (i = 0; i < num_players; ++i) {
+		printf("Waiting for players (%d/%d)...\n", i, num_players);
+		struct hub_player *p = &players[i];
+		if (accept_player(socket_listen, &p->socket) != 0) {
+			for (--i; i >= 0; --i) {
+				drop_player(&players[i]);
+			}
+			return 1;
+		}
+		// Never block on a single player from here on
+		fcntl(p->socket, F_SETFL, fcntl(p->socket, F_GETFL) | O_NONBLOCK);
+		p->connected = 1;
+
+		struct hub_msg msg = {MSG_WELCOME, -1, i, 0, 0, 0, num_players};
+		queue_msg(p, &msg);
+	}
+	printf("All players joined, waiting for fleets\n");
+
+	struct pollfd fds[FFA_PLAYERS_MAX];
+	int started = 0;
+	int turn = -1;
+
+	for (;;) {
+		// Start once every remaining player has placed their ships
+		if (!started) {
+			int pending = 0;
+			for (i = 0; i < num_players; ++i) {
+				pending += players[i].connected && !players[i].ready;
+			}
+			if (pending == 0) {
+				started = 1;
+				printf("All fleets received, starting game\n");
+			}
+		}
+		if (started) {
+			const int alive = update_eliminations(num_players);
+			if (alive <= 1) {
+				const int winner = next_turn(num_players, -1);
+				printf("Game over, winner: player %d\n", winner + 1);
+
+				struct hub_msg msg = {MSG_GAMEOVER, winner, -1, 0, 0, 0, -1};
+				broadcast(num_players, &msg);
+				break;
+			}
+			if (turn == -1 || !is_alive(&players[turn])) {
+				turn = next_turn(num_players, turn);
+
+				struct hub_msg msg = {MSG_TURN, turn, -1, 0, 0, 0, -1};
+				broadcast(num_players, &msg);
+			}
+		}
+
+		int num_fds = 0;
+		for (i = 0; i < num_players; ++i) {
+			const struct hub_player *p = &players[i];
+			fds[i].fd = p->connected ? p->socket : -1;  // negative fds are ignored
+			fds[i].events = POLLIN | (p->out_len > 0 ? POLLOUT : 0);
+			fds[i].revents = 0;
+			num_fds += p->connected;
+		}
+		if (num_fds == 0) {
+			break;
+		}
+		if (poll(fds, num_players, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Poll failed");
+			break;
+		}
+
+		for (i = 0; i < num_players; ++i) {
+			struct hub_player *p = &players[i];
+			if (!p->connected || fds[i].revents == 0) {
+				continue;
+			}
+			if (fds[i].revents & POLLOUT) {
+				flush_player(p);
+			}
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
+			const int needed = p->ready ? (int)sizeof(struct hub_msg)
+			                            : (int)FLEET_MESSAGE_SIZE;
+			const int bytes_recv = recv(p->socket, p->in_buf + p->in_len,
+			                            needed - p->in_len, 0);
+			if (bytes_recv <= 0) {
+				if (bytes_recv == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+					printf("Player %d left\n", i + 1);
+					drop_player(p);
+				}
+				continue;
+			}
+			p->in_len += bytes_recv;
+			if (p->in_len < needed) {
+				continue;
+			}
+			p->in_len = 0;
+
+			if (!p->ready) {
+				receive_fleet(p);
+				continue;
+			}
+			struct hub_msg shot;
+			memcpy(&shot, p->in_buf, sizeof(shot));
+			if (!started || i != turn || !receive_shot(num_players, i, &shot)) {
+				struct hub_msg msg = {MSG_INVALID, i, -1, 0, 0, 0, -1};
+				queue_msg(p, &msg);
+				continue;
+			}
+			// Pass turn on (eliminations are announced first)
+			update_eliminations(num_players);
+			if (next_turn(num_players, turn) != turn) {
+				turn = next_turn(num_players, turn);
+
+				struct hub_msg msg = {MSG_TURN, turn, -1, 0, 0, 0, -1};
+				broadcast(num_players, &msg);
+			}
+		}
+	}
+
+	// Give players a moment to receive the final messages
+	for (;;) {
+		int num_fds = 0;
+		for (i = 0; i < num_players; ++i) {
+			if (players[i].connected && players[i].out_len > 0) {
+				fds[num_fds].fd = players[i].socket;
+				fds[num_fds].events = POLLOUT;
+				num_fds++;
+			}
+		}
+		if (num_fds == 0 || poll(fds, num_fds, HUB_LINGER_MS) <= 0) {
+			break;
+		}
+		for (i = 0; i < num_players; ++i) {
+			flush_player(&players[i]);
+		}
+	}
+	for (i = 0; i < num_players; ++i) {
+		drop_player(&players[i]);
+	}
+	return 0;
+}
+
+// PRE: Shooter, target and result of a shot
+// POST: -
+static void print_ffa_result(const int self, const struct hub_msg *msg) {
+	if (msg->shooter == self) {
+		printf("You shot player %d: (%d, %d) ", msg->target + 1,
+		       msg->row, msg->col);
+	} else if (msg->target == self) {
+		printf("Player %d shot you: (%d, %d) ", msg->shooter + 1,
+		       msg->row, msg->col);
+	} else {
+		printf("Player %d shot player %d: (%d, %d) ", msg->shooter + 1,
+		       msg->target + 1, msg->row, msg->col);
+	}
+	if (msg->result) {
+		print_str_col("HIT!", RED);
+	} else {
+		print_str_col("MISS!", CYAN);
+	}
+	printf("\n");
+}
+
+// PRE: Socket connected to hub, shot message to fill in and what is known
+//      about the opponents
+// POST: Asks player for target and coordinates until they are plausible
+//       and sends the shot; returns 0 on success, 1 on error
+static int send_ffa_shot(const int socket_peer, const int self,
+                         const int num_players, const int *eliminated,
+                         char views[][BOARD_SIZE], int *last_target) {
+	int shot[3];  // target, row, col
+	int given, target, row, col;
+	for (;;) {
+		while(!is_valid_input(given = input_ints(shot, 3), 3));
+		if (given == INPUT_END) {
+			printf("\nEnd of input, leaving the game\n");
+			return 1;
+		}
+		target = shot[0];
+		row = shot[1];
+		col = shot[2];
+		if (target >= 1 && target <= num_players && target - 1 != self &&
+		    !eliminated[target - 1] && is_inside(row - 1, col - 1) &&
+		    views[target - 1][(row - 1) * BOARD_LENGTH + col - 1] == WATER) {
+			break;
+		}
+		printf("Invalid target or coordinates, try again: ");
+	}
+	*last_target = target - 1;
+
+	struct hub_msg msg = {MSG_SHOT, self, target - 1, row, col, 0, -1};
+	if (send_full(socket_peer, &msg, sizeof(msg)) < 0) {
+		perror("Send failed");
+		return 1;
+	}
+	return 0;
+}
+
+// PRE: Socket connected to a hub
+// POST: Plays a free-for-all game; returns 0 on success, 1 on error
+int play_free_for_all(const int socket_peer) {
+	struct hub_msg msg = {0};
+	const int msg_size = sizeof(msg);
+
+	printf("Waiting for hub...\n");
+	if (recv_full(socket_peer, &msg, msg_size) <= 0 || msg.type != MSG_WELCOME) {
+		fprintf(stderr, "Hub did not welcome us\n");
+		return 1;
+	}
+	const int self = msg.target;
+	const int num_players = msg.arg;
+	if (num_players < FFA_PLAYERS_MIN || num_players > FFA_PLAYERS_MAX ||
+	    self < 0 || self >= num_players) {
+		fprintf(stderr, "Invalid welcome message\n");
+		return 1;
+	}
+	printf("You are player %d of %d\n", self + 1, num_players);
+
+	// Place own fleet and hand it to the hub
+	int player_map[BOARD_SIZE];
+	char player_board[BOARD_SIZE];
+	int player_ship_count = NUM_SHIP_PARTS;
+	init(player_board, player_map);
+	place_all_ships(player_board, player_map);
+
+	char fleet[FLEET_MESSAGE_SIZE];
+	memcpy(fleet, player_board, BOARD_SIZE * sizeof(char));
+	memcpy(fleet + BOARD_SIZE * sizeof(char), player_map, BOARD_SIZE * sizeof(int));
+	if (send_full(socket_peer, fleet, FLEET_MESSAGE_SIZE) < 0) {
+		perror("Send failed");
+		return 1;
+	}
+	printf("Waiting for other players...\n");
+
+	// What we know about the opponents
+	char views[FFA_PLAYERS_MAX][BOARD_SIZE];
+	int parts_left[FFA_PLAYERS_MAX];
+	int eliminated[FFA_PLAYERS_MAX];
+	int last_target = -1;
+	int i;
+	for (i = 0; i < num_players; ++i) {
+		memset(views[i], WATER, BOARD_SIZE);
+		parts_left[i] = NUM_SHIP_PARTS;
+		eliminated[i] = 0;
+	}
+
+	for (;;) {
+		const int bytes_recv = recv_full(socket_peer, &msg, msg_size);
+		if (bytes_recv == 0) {
+			fprintf(stderr, "Hub closed the connection\n");
+			return 1;
+		}
+		if (bytes_recv < 0) {
+			perror("Hub recv failed");
+			return 1;
+		}
+		switch (msg.type) {
+			case MSG_TURN:
+			if (msg.shooter != self) {
+				printf("Player %d is aiming...\n", msg.shooter + 1);
+				break;
+			}
+			// Show own board next to the last opponent shot at
+			if (last_target == -1 || eliminated[last_target]) {
+				for (last_target = 0; last_target < num_players; ++last_target) {
+					if (last_target != self && !eliminated[last_target]) {
+						break;
+					}
+				}
+			}
+			printf("\nYour board next to player %d:\n", last_target + 1);
+			draw_board_side_by_side(player_board, views[last_target], PLAYING);
+			for (i = 0; i < num_players; ++i) {
+				if (i != self && !eliminated[i]) {
+					printf("Player %d: %d ship part(s) left\n", i + 1, parts_left[i]);
+				}
+			}
+			printf("Enter target player and shoot coords: ");
+			if (send_ffa_shot(socket_peer, self, num_players, eliminated,
+			                  views, &last_target) != 0) {
+				return 1;
+			}
+			break;
+
+			case MSG_INVALID:
+			printf("Shot rejected by hub, try again: ");
+			if (send_ffa_shot(socket_peer, self, num_players, eliminated,
+			                  views, &last_target) != 0) {
+				return 1;
+			}
+			break;
+
+			case MSG_RESULT:
+			if (msg.target < 0 || msg.target >= num_players) {
+				break;
+			}
+			print_ffa_result(self, &msg);
+			if (msg.target == self) {
+				shoot(msg.row, msg.col, player_board, player_map,
+				      &player_ship_count, player_ships, SELF);
+			} else {
+				if (is_inside(msg.row - 1, msg.col - 1)) {
+					views[msg.target][(msg.row - 1) * BOARD_LENGTH + msg.col - 1] =
+					    msg.result ? HIT : MISS;
+				}
+				parts_left[msg.target] -= msg.result;
+				if (0 <= msg.arg && msg.arg < NUM_SHIPS) {
+					printf("Player %d's %s has been destroyed!\n",
+					       msg.target + 1, player_ships[msg.arg].name);
+				}
+			}
+			break;
+
+			case MSG_ELIMINATED:
+			if (msg.target < 0 || msg.target >= num_players) {
+				break;
+			}
+			eliminated[msg.target] = 1;
+			if (msg.target == self) {
+				print_str_col("You have been eliminated!", RED);
+				printf("\n");
+			} else {
+				printf("Player %d has been eliminated\n", msg.target + 1);
+			}
+			break;
+
+			case MSG_GAMEOVER:
+			if (msg.shooter == self) {
+				printf("YOU WON! :)\n");
+			} else if (msg.shooter >= 0) {
+				printf("Player %d won the game\n", msg.shooter + 1);
+			} else {
+				printf("Nobody is left standing\n");
+			}
+			return 0;
+
+			default:
+			fprintf(stderr, "Unknown message from hub\n");
+			return 1;
+		}
+	}
+}
@@ -0,0 +1,270 @@
+#include "clock.h"
+#include "input.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Internal result of next_char once the deadline passed
+#define TIMED_OUT (-2)
+
+// Source of all input, read in large chunks instead of one scanf per prompt
+static int input_fd = STDIN_FILENO;
+static int batch = 0;
+static int ended = 0;    // end of input reached, nothing more will come
+static int starved = 0;  // last read gave up, buffered input is incomplete
+static uint64_t deadline = 0;
+static char buffer[INPUT_BUFFER_SIZE];
+static int buffer_pos = 0, buffer_len = 0;
+// Token read but not consumed yet
+static char pending[INPUT_TOKEN_SIZE];
+static int has_pending = 0;
+// Where the read in progress started, to give it back when it times out
+static int mark_pos = 0;
+static char mark_pending[INPUT_TOKEN_SIZE];
+static int mark_has_pending = 0;
+
+// PRE: Path of a script ("-" for standard input)
+// POST: All further input is read from the script in batch mode, which
+//       neither prompts nor renders; returns 0 on success, 1 otherwise
+int input_open_batch(const char *path) {
+	if (strcmp(path, "-") != 0) {
+		const int fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			perror("Could not open script");
+			return 1;
+		}
+		input_fd = fd;
+	}
+	batch = 1;
+	return 0;
+}
+
+// PRE: -
+// POST: 1 in batch mode, 0 otherwise
+int is_batch(void) {
+	return batch;
+}
+
+// PRE: -
+// POST: Level of messages meant for the player, which batch mode hides
+//       unless debugging
+enum LOG_LEVEL chatter_level(void) {
+	return batch ? LOG_DEBUG : LOG_INFO;
+}
+
+// PRE: -
+// POST: File descriptor input is read from, to wait for it with poll
+int input_source(void) {
+	return input_fd;
+}
+
+// PRE: Monotonic time (see now_ns) reads may wait for input until, 0 to
+//      wait as long as it takes
+// POST: Reads that would have to wait past it return INPUT_TIMEOUT and
+//       consume nothing; a deadline already passed only takes input that
+//       is there
+void input_set_deadline(const uint64_t time) {
+	deadline = time;
+}
+
+// PRE: -
+// POST: 1 if a token is already buffered (poll would not report it), 0
+//       otherwise, or if the last read timed out waiting for the rest
+int input_buffered(void) {
+	if (starved) {
+		return 0;
+	}
+	if (has_pending) {
+		return 1;
+	}
+	int i;
+	for (i = buffer_pos; i < buffer_len; ++i) {
+		if (!isspace((unsigned char)buffer[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// PRE: printf-style format and arguments
+// POST: Printed unless in batch mode
+void prompt(const char *format, ...) {
+	if (batch) {
+		return;
+	}
+	log_flush_console();  // messages queued before the prompt come first
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	fflush(stdout);  // visible while waiting for the answer
+	const size_t len = strlen(format);
+	log_midline(len > 0 && format[len - 1] != '\n');
+}
+
+// PRE: -
+// POST: Where the read that starts now began remembered
+static void begin_read(void) {
+	mark_pos = buffer_pos;
+	mark_has_pending = has_pending;
+	if (has_pending) {
+		memcpy(mark_pending, pending, INPUT_TOKEN_SIZE);
+	}
+}
+
+// PRE: Read that timed out
+// POST: Everything it took given back; returns INPUT_TIMEOUT
+static int rewind_read(void) {
+	buffer_pos = mark_pos;
+	has_pending = mark_has_pending;
+	if (has_pending) {
+		memcpy(pending, mark_pending, INPUT_TOKEN_SIZE);
+	}
+	starved = 1;
+	return INPUT_TIMEOUT;
+}
+
+// PRE: Read in progress
+// POST: Next character of input, EOF at end of input, TIMED_OUT if more
+//       input would have to be waited for past the deadline
+static int next_char(void) {
+	if (buffer_pos == buffer_len) {
+		if (ended) {
+			return EOF;
+		}
+		// Keep what the read in progress took, in case it has to be given back
+		if (mark_pos > 0) {
+			memmove(buffer, buffer + mark_pos, buffer_len - mark_pos);
+			buffer_len -= mark_pos;
+			buffer_pos -= mark_pos;
+			mark_pos = 0;
+		}
+		if (buffer_len == (int)sizeof(buffer)) {
+			buffer_len = buffer_pos = 0;  // one read this long cannot be given back
+		}
+		if (deadline != 0) {
+			const uint64_t now = now_ns();
+			struct pollfd fd = {input_fd, POLLIN, 0};
+			const int timeout_ms = (deadline > now) ? (int)((deadline - now) / 1000000u) + 1 : 0;
+			if (poll(&fd, 1, timeout_ms) == 0) {
+				return TIMED_OUT;
+			}
+		}
+		ssize_t bytes;
+		do {
+			bytes = read(input_fd, buffer + buffer_len, sizeof(buffer) - buffer_len);
+		} while (bytes < 0 && errno == EINTR);
+		if (bytes <= 0) {
+			ended = 1;
+			return EOF;
+		}
+		buffer_len += bytes;
+		starved = 0;
+		log_midline(0);
+	}
+	return (unsigned char)buffer[buffer_pos++];
+}
+
+// PRE: Read in progress
+// POST: Next token without consuming it, NULL at end of input or once the
+//       deadline passed (status says which)
+static const char *peek_token(int *status) {
+	if (has_pending) {
+		return pending;
+	}
+	int c;
+	while ((c = next_char()) >= 0 && isspace(c));
+	if (c < 0) {
+		*status = (c == EOF) ? INPUT_END : INPUT_TIMEOUT;
+		return NULL;
+	}
+	int len = 0;
+	do {
+		if (len < INPUT_TOKEN_SIZE - 1) {
+			pending[len++] = c;
+		}
+	} while ((c = next_char()) >= 0 && !isspace(c));
+	if (c == TIMED_OUT) {
+		// Only whitespace or the end of input completes a token
+		*status = INPUT_TIMEOUT;
+		return NULL;
+	}
+	pending[len] = '\0';
+	has_pending = 1;
+	return pending;
+}
+
+// PRE: Array for number of integers to read
+// POST: Returns how many integers were read before a token could not be
+//       parsed (that token is left for input_skip), INPUT_END if the input
+//       ended first, INPUT_TIMEOUT if the deadline passed first
+int input_ints(int *values, const int count) {
+	int i, status;
+	begin_read();
+	for (i = 0; i < count; ++i) {
+		const char *token = peek_token(&status);
+		if (token == NULL) {
+			return (status == INPUT_TIMEOUT) ? rewind_read() : INPUT_END;
+		}
+		char *end;
+		errno = 0;
+		const long value = strtol(token, &end, 10);
+		if (*end != '\0' || errno != 0) {
+			return i;
+		}
+		values[i] = (int)value;
+		has_pending = 0;
+	}
+	return count;
+}
+
+// PRE: -
+// POST: First character of the next token; returns 1, INPUT_END at end of
+//       input, INPUT_TIMEOUT once the deadline passed
+int input_char(char *c) {
+	int status;
+	begin_read();
+	const char *token = peek_token(&status);
+	if (token == NULL) {
+		return (status == INPUT_TIMEOUT) ? rewind_read() : INPUT_END;
+	}
+	*c = token[0];
+	has_pending = 0;
+	return 1;
+}
+
+// PRE: Buffer and its size
+// POST: Next token, cut to fit buffer; returns 1, INPUT_END at end of
+//       input, INPUT_TIMEOUT once the deadline passed
+int input_word(char *word, const size_t size) {
+	int status;
+	begin_read();
+	const char *token = peek_token(&status);
+	if (token == NULL) {
+		return (status == INPUT_TIMEOUT) ? rewind_read() : INPUT_END;
+	}
+	snprintf(word, size, "%s", token);
+	has_pending = 0;
+	return 1;
+}
+
+// PRE: -
+// POST: Next token discarded, unless it is not complete by the deadline
+void input_skip(void) {
+	int status;
+	begin_read();
+	if (peek_token(&status) == NULL) {
+		if (status == INPUT_TIMEOUT) {
+			rewind_read();
+		}
+		return;
+	}
+	has_pending = 0;
+}
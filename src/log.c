@@ -0,0 +1,316 @@
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// One queued record
+struct log_record {
+	struct timespec time;
+	const char *event;
+	enum LOG_LEVEL level;
+	char message[LOG_MESSAGE_SIZE];
+	char fields[LOG_FIELDS_SIZE];
+};
+
+// Records of one thread; only that thread moves head, only the sink tail
+struct log_buffer {
+	struct log_buffer *next;
+	int tid;
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_uint dropped;
+	unsigned int reported;         // drops already written out (sink only)
+	char fields[LOG_FIELDS_SIZE];  // for the next record
+	struct log_record records[LOG_BUFFER_RECORDS];
+};
+
+static const char *level_names[NUM_LOG_LEVELS] = {
+	[LOG_DEBUG] = "debug",
+	[LOG_INFO] = "info",
+	[LOG_WARN] = "warn",
+	[LOG_ERROR] = "error"
+};
+
+static _Thread_local struct log_buffer *local_buffer;
+static _Atomic(struct log_buffer *) buffers;  // buffers of all threads
+static atomic_int next_tid = 1;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static enum LOG_LEVEL min_level = LOG_INFO;
+static int log_fd = -1;  // logfmt file, -1 for the console
+static atomic_int midline;  // console shows a prompt waiting for its answer
+
+// Output of the sink, written once full or when the destination changes;
+// only touched with sink_lock held
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+static char output[LOG_OUTPUT_SIZE];
+static int output_len = 0;
+static int output_fd = STDOUT_FILENO;
+
+// PRE: sink_lock held
+// POST: Output written to its destination and emptied
+static void write_output(void) {
+	int offset = 0;
+	while (offset < output_len) {
+		const ssize_t bytes = write(output_fd, output + offset, output_len - offset);
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytes <= 0) {
+			break;  // nowhere left to report this
+		}
+		offset += bytes;
+	}
+	output_len = 0;
+}
+
+// PRE: sink_lock held, destination and text shorter than LOG_OUTPUT_SIZE
+// POST: Text added to the output
+static void append(const int fd, const char *text, const int len) {
+	if (fd != output_fd || output_len + len > LOG_OUTPUT_SIZE) {
+		write_output();
+		output_fd = fd;
+	}
+	memcpy(output + output_len, text, len);
+	output_len += len;
+}
+
+// PRE: Line to write to, its size and a message
+// POST: Message added as a quoted logfmt value without colors, newlines or
+//       other control characters; returns its length
+static int quote_message(char *line, const int size, const char *message) {
+	int len = 0;
+	const char *c;
+	line[len++] = '"';
+	for (c = message; *c != '\0' && len < size - 3; ++c) {
+		if (*c == '\033') {
+			// Skip color escape up to its final letter
+			while (c[1] != '\0' && !(c[1] >= 'A' && c[1] <= 'Z') &&
+			       !(c[1] >= 'a' && c[1] <= 'z')) {
+				c++;
+			}
+			c += (c[1] != '\0');
+			continue;
+		}
+		if ((unsigned char)*c < ' ') {
+			continue;
+		}
+		if (*c == '"' || *c == '\\') {
+			line[len++] = '\\';
+		}
+		line[len++] = *c;
+	}
+	line[len++] = '"';
+	return len;
+}
+
+// PRE: sink_lock held, thread and record
+// POST: Record added to the output
+static void format_record(const int tid, const struct log_record *r) {
+	if (log_fd < 0) {
+		const int fd = (r->level >= LOG_WARN) ? STDERR_FILENO : STDOUT_FILENO;
+		if (atomic_exchange(&midline, 0)) {
+			append(fd, "\n", 1);  // not behind the prompt
+		}
+		append(fd, r->message, strlen(r->message));
+		append(fd, "\n", 1);
+		return;
+	}
+	char line[2 * LOG_MESSAGE_SIZE + LOG_FIELDS_SIZE + 128];
+	struct tm tm;
+	gmtime_r(&r->time.tv_sec, &tm);
+	int len = strftime(line, sizeof(line), "ts=%Y-%m-%dT%H:%M:%S", &tm);
+	len += snprintf(line + len, sizeof(line) - len,
+	                ".%03ldZ level=%s pid=%d thread=%d event=%s msg=",
+	                r->time.tv_nsec / 1000000, level_names[r->level], (int)getpid(), tid,
+	                r->event);
+	len += quote_message(line + len, sizeof(line) - len - LOG_FIELDS_SIZE - 2, r->message);
+	if (r->fields[0] != '\0') {
+		len += snprintf(line + len, sizeof(line) - len, " %s", r->fields);
+	}
+	line[len++] = '\n';
+	append(log_fd, line, len);
+}
+
+// PRE: -
+// POST: Records of all threads written out
+static void drain(void) {
+	pthread_mutex_lock(&sink_lock);
+	struct log_buffer *buffer;
+	for (buffer = atomic_load(&buffers); buffer != NULL; buffer = buffer->next) {
+		const unsigned int head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+		unsigned int tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+		for (; tail != head; ++tail) {
+			format_record(buffer->tid, &buffer->records[tail & (LOG_BUFFER_RECORDS - 1)]);
+		}
+		atomic_store_explicit(&buffer->tail, tail, memory_order_release);
+		// Say so if records were lost, once per batch of drops
+		const unsigned int dropped = atomic_load_explicit(&buffer->dropped, memory_order_relaxed);
+		if (dropped != buffer->reported) {
+			struct log_record r = {.event = "log", .level = LOG_WARN, .fields = ""};
+			clock_gettime(CLOCK_REALTIME, &r.time);
+			snprintf(r.message, LOG_MESSAGE_SIZE, "Dropped %u log record(s)",
+			         dropped - buffer->reported);
+			format_record(buffer->tid, &r);
+			buffer->reported = dropped;
+		}
+	}
+	write_output();
+	pthread_mutex_unlock(&sink_lock);
+}
+
+// PRE: -
+// POST: Drains records every LOG_DRAIN_MS for the life of the process
+static void *run_sink(void *arg) {
+	(void)arg;
+	const struct timespec interval = {0, LOG_DRAIN_MS * 1000000L};
+	for (;;) {
+		nanosleep(&interval, NULL);
+		drain();
+	}
+	return NULL;
+}
+
+// PRE: -
+// POST: Level and destination read from the environment, sink started
+static void init_log(void) {
+	const char *level = getenv(LOG_LEVEL_ENV);
+	int i;
+	for (i = 0; level != NULL && i < NUM_LOG_LEVELS; ++i) {
+		if (strcmp(level, level_names[i]) == 0) {
+			min_level = i;
+		}
+	}
+	const char *path = getenv(LOG_FILE_ENV);
+	if (path != NULL) {
+		log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (log_fd < 0) {
+			perror("Could not open log file, logging to console");
+		}
+	}
+	pthread_t sink;
+	if (pthread_create(&sink, NULL, run_sink, NULL) == 0) {
+		pthread_detach(sink);
+	}
+	atexit(log_flush);
+}
+
+// PRE: -
+// POST: Buffer of the calling thread, allocated and published lock-free on
+//       first use; NULL if memory ran out
+static struct log_buffer *get_buffer(void) {
+	struct log_buffer *buffer = local_buffer;
+	if (buffer == NULL) {
+		buffer = calloc(1, sizeof(*buffer));
+		if (buffer == NULL) {
+			return NULL;
+		}
+		buffer->tid = atomic_fetch_add(&next_tid, 1);
+		buffer->next = atomic_load(&buffers);
+		while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer));
+		local_buffer = buffer;
+	}
+	return buffer;
+}
+
+// PRE: printf-style format of logfmt fields (key=value separated by spaces)
+// POST: Fields attached to the next record of the calling thread; ignored
+//       on the console
+void log_fields(const char *format, ...) {
+	pthread_once(&log_once, init_log);
+	struct log_buffer *buffer;
+	if (log_fd < 0 || (buffer = get_buffer()) == NULL) {
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buffer->fields, LOG_FIELDS_SIZE, format, args);
+	va_end(args);
+}
+
+// PRE: Level, static name of the event and printf-style message
+// POST: Record queued unless below BATTLE_LOG_LEVEL
+void log_write(const enum LOG_LEVEL level, const char *event, const char *format, ...) {
+	pthread_once(&log_once, init_log);
+	if (level < min_level) {
+		if (local_buffer != NULL) {
+			local_buffer->fields[0] = '\0';
+		}
+		return;
+	}
+	struct log_buffer *buffer = get_buffer();
+	if (buffer == NULL) {
+		return;
+	}
+	const unsigned int head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+	const unsigned int tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+	if (head - tail == LOG_BUFFER_RECORDS) {
+		atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+		buffer->fields[0] = '\0';
+		return;
+	}
+	struct log_record *r = &buffer->records[head & (LOG_BUFFER_RECORDS - 1)];
+	if (log_fd >= 0) {
+		clock_gettime(CLOCK_REALTIME, &r->time);
+	}
+	r->event = event;
+	r->level = level;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(r->message, LOG_MESSAGE_SIZE, format, args);
+	va_end(args);
+	memcpy(r->fields, buffer->fields, LOG_FIELDS_SIZE);
+	buffer->fields[0] = '\0';
+	atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+// PRE: Static name of the event and a message, after a call that set errno
+// POST: Error queued like perror prints it
+void log_errno(const char *event, const char *message) {
+	const int err = errno;
+	log_fields("errno=%d", err);
+	log_write(LOG_ERROR, event, "%s: %s", message, strerror(err));
+}
+
+// PRE: Whether the console is in the middle of a line: 1 after a prompt,
+//      0 once its answer was read (the echo of which ended the line)
+// POST: The next record on the console starts on a new line if needed
+void log_midline(const int is_midline) {
+	atomic_store(&midline, is_midline);
+}
+
+// PRE: -
+// POST: Standard output flushed and every record queued so far written;
+//       call before exiting
+void log_flush(void) {
+	fflush(stdout);
+	if (atomic_load(&buffers) != NULL) {
+		drain();
+	}
+}
+
+// PRE: -
+// POST: Records bound for the console written ahead of what the caller
+//       prints next; without any queued, or when logging to a file, nothing
+//       but standard output is flushed
+void log_flush_console(void) {
+	fflush(stdout);
+	if (log_fd >= 0) {
+		return;
+	}
+	struct log_buffer *buffer;
+	for (buffer = atomic_load(&buffers); buffer != NULL; buffer = buffer->next) {
+		if (atomic_load_explicit(&buffer->head, memory_order_acquire) !=
+		    atomic_load_explicit(&buffer->tail, memory_order_relaxed)) {
+			drain();
+			return;
+		}
+	}
+}
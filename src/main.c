@@ -1,24 +1,164 @@
 #include "battle.h"
+#include "clock.h"
 #include "communicate.h"
+#include "estimate.h"
+#include "hub.h"
+#include "input.h"
+#include "matchmaking.h"
+#include "metrics.h"
+#include "scores.h"
+#include "server.h"
+#include "session.h"
+#include "tournament.h"
 
 // Global variables to keep track of game progress
-int player_ship_count = NUM_SHIP_PARTS;
 int player_score = 0;
-
-int opponent_ship_count = NUM_SHIP_PARTS;
 int opponent_score = 0;
 
+// PRE: Result of a game for one player
+// POST: Result of the same game for the other player
+static enum RESULT opposite_result(const enum RESULT result) {
+	switch (result) {
+		case RESULT_WIN:
+		return RESULT_LOSS;
+		case RESULT_LOSS:
+		return RESULT_WIN;
+		default:
+		return RESULT_DRAW;
+	}
+}
+
+// PRE: Free-for-all mode and command line arguments
+// POST: Hosts or joins a free-for-all game; returns exit code
+static int free_for_all(const int argc, char *argv[], enum MODE mode) {
+	int socket_listen = -1, socket_peer = -1;
+	int status;
+	
+	if (mode == HUB) {
+		const int num_players = (argc == 3) ? atoi(argv[2]) : 0;
+		if (num_players < FFA_PLAYERS_MIN || num_players > FFA_PLAYERS_MAX) {
+			fprintf(stderr, "Number of players must be between %d and %d\n",
+			        FFA_PLAYERS_MIN, FFA_PLAYERS_MAX);
+			return 1;
+		}
+		if (listen_players(&socket_listen, num_players) != 0) {
+			return 1;
+		}
+		status = run_hub(socket_listen, num_players);
+		close(socket_listen);
+	} else {
+		if (connect_players(&socket_listen, &socket_peer, JOIN) != 0) {
+			return 1;
+		}
+		status = play_free_for_all(socket_peer);
+		close(socket_peer);
+	}
+	return status;
+}
+
+// PRE: Command line arguments
+// POST: Runs a match server; returns exit code
+static int serve_matches(const int argc, char *argv[]) {
+	int num_game_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int num_buckets = 1;
+	if (argc >= 3) {
+		num_game_threads = atoi(argv[2]);
+	}
+	if (argc >= 4) {
+		num_buckets = atoi(argv[3]);
+	}
+	if (num_game_threads < 1 || num_game_threads > SERVER_GAME_THREADS_MAX) {
+		fprintf(stderr, "Number of game threads must be between 1 and %d\n",
+		        SERVER_GAME_THREADS_MAX);
+		return 1;
+	}
+	if (num_buckets < 1 || num_buckets > SKILL_BUCKETS_MAX) {
+		fprintf(stderr, "Number of skill buckets must be between 1 and %d\n",
+		        SKILL_BUCKETS_MAX);
+		return 1;
+	}
+	
+	int socket_listen = -1;
+	if (listen_players(&socket_listen, SOMAXCONN) != 0) {
+		return 1;
+	}
+	metrics_start();  // optional, the server runs without it
+	const int status = run_server(socket_listen, num_game_threads, num_buckets);
+	close(socket_listen);
+	return status;
+}
+
+// PRE: Command line arguments
+// POST: Plays a tournament between engines; returns exit code
+static int play_tournament(const int argc, char *argv[]) {
+	const int num_games = (argc >= 3) ? atoi(argv[2]) : 0;
+	if (argc < 4 || argc > 5) {
+		fprintf(stderr, "Tournament needs a number of games and one or two engines\n");
+		return 1;
+	}
+	if (num_games < 1 || num_games > TOURNAMENT_GAMES_MAX) {
+		fprintf(stderr, "Number of games must be between 1 and %d\n",
+		        TOURNAMENT_GAMES_MAX);
+		return 1;
+	}
+	return run_tournament(num_games, argv[3], (argc == 5) ? argv[4] : NULL);
+}
+
+// PRE: -
+// POST: Prints best players of the score store; returns exit code
+static int print_leaderboard(void) {
+	struct score_store store;
+	struct score_entry entries[LEADERBOARD_SIZE];
+	int len = 0;
+	// Nothing was recorded yet without a store
+	const int has_store = (access(SCORE_STORE_PATH, F_OK) == 0);
+	if (has_store) {
+		if (score_store_open(&store, SCORE_STORE_PATH, 1) != 0) {
+			return 1;
+		}
+		len = score_store_top(&store, entries);
+		score_store_close(&store);
+	}
+	
+	printf(" #  %-*s  score  wins  losses  draws\n", NAME_SIZE - 1, "name");
+	int i;
+	for (i = 0; i < len; ++i) {
+		printf("%2d  %-*s  %5d  %4d  %6d  %5d\n", i + 1, NAME_SIZE - 1,
+		       entries[i].name, entries[i].score, entries[i].wins,
+		       entries[i].losses, entries[i].draws);
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[]) {
 	
-	if (argc != 2) {
-		fprintf(stderr, "Usage: ./battle <h(ost), j(oin)>\n");
+	const int has_script = (argc == 4 && strcmp(argv[2], "-b") == 0);
+	if (argc < 2 || (argc != 2 && *argv[1] != HUB && *argv[1] != SERVER &&
+	                 *argv[1] != TOURNAMENT && !has_script)) {
+		fprintf(stderr, "Usage: ./battle <h(ost), j(oin)> [-b <script>]\n"
+		                "       ./battle f <players>  (host free-for-all)\n"
+		                "       ./battle p            (join free-for-all)\n"
+		                "       ./battle s [game threads] [skill buckets]  (match server)\n"
+		                "       ./battle l            (show leaderboard)\n"
+		                "       ./battle t <games> <engine> [engine]  (engine tournament)\n");
 		return 1;
 	}
+	if (*argv[1] == LEADERBOARD) {
+		return print_leaderboard();
+	}
+	if (*argv[1] == HUB || *argv[1] == PLAYER) {
+		return free_for_all(argc, argv, *argv[1]);
+	}
+	if (*argv[1] == SERVER) {
+		return serve_matches(argc, argv);
+	}
+	if (*argv[1] == TOURNAMENT) {
+		return play_tournament(argc, argv);
+	}
 	
 	int socket_listen = -1, socket_peer = -1;
 	const int board_message_size = BOARD_SIZE * sizeof(char);
 	const int map_message_size = BOARD_SIZE * sizeof(int);
-	const int coords_message_size = 2 * sizeof(int);
 	
 	// Connect host (server) with client
 	char mode = *argv[1];
@@ -26,107 +166,172 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "Unrecognized mode; must be either h or j\n");
 		return 1;
 	}
+	if (has_script && input_open_batch(argv[3]) != 0) {
+		return 1;
+	}
+	if (mode == HOST) {
+		metrics_start();  // optional, the game runs without it
+	}
 	if (connect_players(&socket_listen, &socket_peer, mode) != 0) {
 		return 1;
 	}
+	// No wait for the opponent may outlast a whole game clock
+	set_peer_timeout(socket_peer, GAME_LIMIT_S);
 	
-	// Initialize board and map of ships (indices in array of ships)
-	int player_map[BOARD_SIZE], opponent_map[BOARD_SIZE];
-	char player_board[BOARD_SIZE], opponent_board[BOARD_SIZE];
+	// Introduce players to each other
+	char player_name[NAME_SIZE] = {0}, opponent_name[NAME_SIZE];
+	prompt("Enter your name: ");
+	int given;
+	while(!is_valid_input(given = input_word(player_name, NAME_SIZE), 1));
+	if (given == INPUT_END) {
+		log_write(LOG_ERROR, "input", "End of input before the game started");
+		return 1;
+	}
+	if (sendrecv(socket_peer, player_name, opponent_name, NAME_SIZE, mode) != 0) {
+		return 1;
+	}
+	opponent_name[NAME_SIZE - 1] = '\0';
+	prompt("Playing against %s\n", opponent_name);
 	
-beginning:
-	init(player_board, player_map);
+	// The host keeps track of results of both players
+	struct score_store store;
+	int player_record = -1, opponent_record = -1;
+	const int has_store = (mode == HOST && score_store_open(&store, SCORE_STORE_PATH, 0) == 0);
+	if (has_store) {
+		player_record = score_store_lookup(&store, player_name);
+		opponent_record = score_store_lookup(&store, opponent_name);
+	}
 	
-	// Both players individually place ships
+	// Boards, maps of ships (indices in array of ships) and ships of both
+	// players live in a session
+	struct session_pool pool;
+	if (session_pool_init(&pool, 1) != 0) {
+		fprintf(stderr, "Could not allocate session\n");
+		return 1;
+	}
+	int status = 1;
+	struct session *s = session_alloc(&pool);
+	if (s == NULL) {
+		fprintf(stderr, "Could not allocate session\n");
+		goto release;
+	}
+	s->socket[OPPONENT] = socket_peer;
+	char *player_board = s->board[SELF], *opponent_board = s->board[OPPONENT];
+	int *player_map = s->map[SELF], *opponent_map = s->map[OPPONENT];
+	
+beginning:
+	// Both players individually place ships; at the end of input or out of
+	// time the rest is placed at random (and after end of input the first
+	// shot forfeits)
+	input_set_deadline(now_ns() + PLACE_LIMIT_S * 1000000000ull);
 	place_all_ships(player_board, player_map);
+	input_set_deadline(0);
 	
-	// Exchange boards AND ship maps
-	printf("Exchanging player data\n");
+	// Exchange boards AND ship maps; the opponent is on the same clock
+	prompt("Exchanging player data\n");
+	set_peer_timeout(socket_peer, PLACE_LIMIT_S + PEER_GRACE_S);
 	if (sendrecv(socket_peer, player_board, opponent_board, board_message_size, mode) != 0) {
-		return 1;
+		goto cleanup;
 	}
 	if (sendrecv(socket_peer, player_map, opponent_map, map_message_size, mode) != 0) {
-		return 1;
+		goto cleanup;
 	}
-	printf("Exchange done\n");
-	
+	set_peer_timeout(socket_peer, GAME_LIMIT_S);
+	prompt("Exchange done\n");
+	snapshot_placements(s);
+	s->time_left = (uint64_t)GAME_LIMIT_S * 1000000000u;
 	
 	// Draw player and opponent board next to eachother
 	draw_board_side_by_side(player_board, opponent_board, PLAYING);
 	
-	// Shoot coordinates message buffers
-	int player_coords[2], opponent_coords[2];
 	// Game loop
 	for (;;) {
-		int err = exchange_shots(socket_peer, coords_message_size, 
-                   player_coords, player_board, player_map, 
-                   player_ships, &player_ship_count, 
-                   opponent_coords, opponent_board, opponent_map,
-                   opponent_ships, &opponent_ship_count,
-                   mode);
+		int err = exchange_shots(socket_peer, s);
 		if (err != 0) {
-			// Error occured -> exit
-			break;
+			// Connection lost -> try to continue from last complete turn
+			if (resume_game(socket_listen, &socket_peer, s, mode) != 0) {
+				break;
+			}
+			draw_board_side_by_side(player_board, opponent_board, PLAYING);
+			print_win_estimate(s);
+			continue;
 		}
 		
-		if (player_ship_count == 0 || opponent_ship_count == 0) {
+		if (s->ship_count[SELF] == 0 || s->ship_count[OPPONENT] == 0) {
 			// Print updated board (with opponent ships)
 			draw_board_side_by_side(player_board, opponent_board, GAMEOVER);
 			break;
 		} else {
 			// Print updated board (without opponent ships)
 			draw_board_side_by_side(player_board, opponent_board, PLAYING);
+			print_win_estimate(s);
 		}
 	}
+	log_flush_console();  // how the game ended comes before the results
 	// Check if error occurred
-	if (player_ship_count != 0 && opponent_ship_count != 0) {
+	if (s->ship_count[SELF] != 0 && s->ship_count[OPPONENT] != 0) {
 		printf("Connection was interrupted\n");
-		close(socket_peer);
-        if (mode == HOST) close(socket_listen);
-		return 1;
+		goto cleanup;
 	}
 	// Determine who won
-	if (player_ship_count == 0 && opponent_ship_count == 0) {
+	enum RESULT result;
+	if (s->ship_count[SELF] == 0 && s->ship_count[OPPONENT] == 0) {
 		printf("DRAW! :|\n");
 		opponent_score += 1;
 		player_score += 1;
-	} else if (player_ship_count == 0) {
+		result = RESULT_DRAW;
+	} else if (s->ship_count[SELF] == 0) {
 		printf("YOU LOST! :(\n");
 		opponent_score += 2;
+		result = RESULT_LOSS;
 	} else {
 		printf("YOU WON! :)\n");
 		player_score += 2;
+		result = RESULT_WIN;
+	}
+	if (player_record >= 0 && opponent_record >= 0) {
+		score_store_record(&store, player_record, result);
+		score_store_record(&store, opponent_record, opposite_result(result));
 	}
 	printf("Your score: %d\n", player_score);
 	printf("Opponent score: %d\n", opponent_score);
+	if (s->closing) {
+		// Opponent stopped answering, nobody is left to ask for a rematch
+		status = 0;
+		goto cleanup;
+	}
 	
 	// Ask both players if they want a rematch
 	char player_reply;
 	char opponent_reply;
 	int reply_size = sizeof(char);
 	
-	printf("Do you want a rematch? [y/n]: ");
-	while(!is_valid_input(scanf("%*c%c", &player_reply), 1));
+	prompt("Do you want a rematch? [y/n]: ");
+	input_set_deadline(now_ns() + REMATCH_LIMIT_S * 1000000000ull);
+	while(!is_valid_input(given = input_char(&player_reply), 1));
+	input_set_deadline(0);
+	if (given == INPUT_TIMEOUT) {
+		log_write(LOG_INFO, "rematch", "Out of time, no rematch");
+	}
+	if (given < 0) {
+		player_reply = 'n';
+	}
 	
+	set_peer_timeout(socket_peer, REMATCH_LIMIT_S + PEER_GRACE_S);
 	if (sendrecv(socket_peer, &player_reply, &opponent_reply, reply_size, mode) != 0) {
-		return 1;
+		goto cleanup;
 	}
 		
 	if (player_reply == 'y' && opponent_reply == 'y') {
-		printf("\nStarting rematch...\n");
-		// Reset counters
-		player_ship_count = NUM_SHIP_PARTS;
-		opponent_ship_count = NUM_SHIP_PARTS;
-		// Reset number of hits taken
-		for (int i = 0; i < NUM_SHIPS; ++i) {
-			player_ships[i].hits_taken = 0;
-			opponent_ships[i].hits_taken = 0;
-		}
+		prompt("\nStarting rematch...\n");
+		// Reset boards, counters and number of hits taken
+		session_reset(s);
 		// Go back to beginning
 		goto beginning;
 	}
 	
 	// Print final game message
+	log_flush_console();
 	if (player_score < opponent_score) {
 		printf("YOU LOST THE GAME. BETTER LUCK NEXT TIME!\n");
 	} else if (player_score > opponent_score) {
@@ -134,12 +339,19 @@ beginning:
 	} else {
 		printf("DRAW!\n");
 	}
+	status = 0;
+	
+cleanup:
+	session_free(&pool, s);
+release:
+	session_pool_destroy(&pool);
+	if (has_store) {
+		score_store_close(&store);
+	}
 	
 	// Close sockets
 	close(socket_peer);
     if (mode == HOST) close(socket_listen);
 	
-	return 0;
+	return status;
 }
-
-
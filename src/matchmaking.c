@@ -0,0 +1,163 @@
+#include "matchmaking.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+// Packed ticket of an empty waiting slot (no valid socket is -1)
+#define NOBODY_WAITING (UINT64_MAX)
+
+// PRE: Ticket
+// POST: Ticket packed into a single word (without score)
+static uint64_t pack_ticket(const struct ticket *t) {
+	return ((uint64_t)(uint32_t)t->socket << 32) | (uint32_t)t->record;
+}
+
+// PRE: Packed ticket
+// POST: Unpacked ticket
+static struct ticket unpack_ticket(const uint64_t packed) {
+	struct ticket t;
+	t.socket = (int)(uint32_t)(packed >> 32);
+	t.record = (int)(uint32_t)packed;
+	t.score = -1;
+	return t;
+}
+
+// PRE: Queue
+// POST: Returns 0 on success, 1 if memory could not be allocated
+int match_queue_init(struct match_queue *q) {
+	q->cells = aligned_alloc(CACHE_LINE_SIZE,
+	                         MATCH_QUEUE_SIZE * sizeof(struct queue_cell));
+	if (q->cells == NULL) {
+		return 1;
+	}
+	size_t i;
+	for (i = 0; i < MATCH_QUEUE_SIZE; ++i) {
+		atomic_init(&q->cells[i].sequence, i);
+	}
+	atomic_init(&q->enqueue_pos, 0);
+	atomic_init(&q->dequeue_pos, 0);
+	atomic_init(&q->waiting, NOBODY_WAITING);
+	return 0;
+}
+
+// PRE: Queue and ticket; safe from any thread
+// POST: Returns 0 if ticket was queued, 1 if queue is full
+int match_queue_push(struct match_queue *q, const struct ticket *t) {
+	size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+	for (;;) {
+		struct queue_cell *cell = &q->cells[pos & (MATCH_QUEUE_SIZE - 1)];
+		const size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			// Cell is free, try to claim it
+			if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos,
+			        pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				cell->ticket = *t;
+				atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+				return 0;
+			}
+		} else if (diff < 0) {
+			return 1;  // full
+		} else {
+			pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+		}
+	}
+}
+
+// PRE: Queue; safe from any thread
+// POST: Returns 0 and oldest ticket, 1 if queue is empty
+int match_queue_pop(struct match_queue *q, struct ticket *t) {
+	size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+	for (;;) {
+		struct queue_cell *cell = &q->cells[pos & (MATCH_QUEUE_SIZE - 1)];
+		const size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			// Cell is filled, try to take it
+			if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos,
+			        pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				*t = cell->ticket;
+				atomic_store_explicit(&cell->sequence, pos + MATCH_QUEUE_SIZE,
+				                      memory_order_release);
+				return 0;
+			}
+		} else if (diff < 0) {
+			return 1;  // empty
+		} else {
+			pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+		}
+	}
+}
+
+// PRE: Matchmaker and number of skill buckets (1 to SKILL_BUCKETS_MAX)
+// POST: Returns 0 on success, 1 if memory could not be allocated
+int matchmaker_init(struct matchmaker *mm, const int num_buckets) {
+	mm->num_buckets = num_buckets;
+	int i;
+	for (i = 0; i < num_buckets; ++i) {
+		if (match_queue_init(&mm->buckets[i]) != 0) {
+			for (--i; i >= 0; --i) {
+				free(mm->buckets[i].cells);
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// PRE: Matchmaker nobody uses anymore
+// POST: Memory released; sockets of players still waiting are closed
+void matchmaker_destroy(struct matchmaker *mm) {
+	int i;
+	for (i = 0; i < mm->num_buckets; ++i) {
+		struct match_queue *q = &mm->buckets[i];
+		struct ticket t;
+		while (match_queue_pop(q, &t) == 0) {
+			close(t.socket);
+		}
+		const uint64_t waiting = atomic_load(&q->waiting);
+		if (waiting != NOBODY_WAITING) {
+			close(unpack_ticket(waiting).socket);
+		}
+		free(q->cells);
+	}
+}
+
+// PRE: Matchmaker and player looking for a game; safe from any thread
+// POST: Returns 0 if player was queued, 1 if the bucket is full
+int matchmaker_enqueue(struct matchmaker *mm, const struct ticket *t) {
+	int bucket = (t->score > 0) ? t->score / SKILL_BUCKET_WIDTH : 0;
+	if (bucket >= mm->num_buckets) {
+		bucket = mm->num_buckets - 1;
+	}
+	return match_queue_push(&mm->buckets[bucket], t);
+}
+
+// PRE: Matchmaker; safe from any thread
+// POST: Returns 1 and the two players if a pair was formed (player that
+//       waited longer first), 0 if nobody can be paired right now
+int matchmaker_pair(struct matchmaker *mm, struct ticket *first,
+                    struct ticket *second) {
+	int i;
+	for (i = 0; i < mm->num_buckets; ++i) {
+		struct match_queue *q = &mm->buckets[i];
+		struct ticket t;
+		while (match_queue_pop(q, &t) == 0) {
+			// Either take the player already waiting or become the waiting one
+			for (;;) {
+				const uint64_t waiting = atomic_exchange(&q->waiting, NOBODY_WAITING);
+				if (waiting != NOBODY_WAITING) {
+					*first = unpack_ticket(waiting);
+					*second = t;
+					return 1;
+				}
+				uint64_t expected = NOBODY_WAITING;
+				if (atomic_compare_exchange_strong(&q->waiting, &expected,
+				                                   pack_ticket(&t))) {
+					break;
+				}
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,321 @@
+#include "clock.h"
+#include "input.h"    // chatter_level
+#include "log.h"
+#include "metrics.h"
+#include "session.h"  // CACHE_LINE_SIZE
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Upper bounds of histogram buckets, in nanoseconds and as exported
+static const uint64_t bucket_bounds[HISTOGRAM_BUCKETS] = {
+	100000, 500000, 1000000, 5000000, 10000000, 50000000, 100000000,
+	500000000, 1000000000, 5000000000, 10000000000, 60000000000
+};
+static const char *bucket_labels[HISTOGRAM_BUCKETS] = {
+	"0.0001", "0.0005", "0.001", "0.005", "0.01", "0.05", "0.1",
+	"0.5", "1", "5", "10", "60"
+};
+
+// Exported names and help of metrics
+static const char *metric_names[NUM_METRICS] = {
+	[METRIC_SESSIONS] = "battle_active_sessions",
+	[METRIC_TURNS] = "battle_turns_total",
+	[METRIC_BYTES_SENT] = "battle_sent_bytes_total",
+	[METRIC_BYTES_RECEIVED] = "battle_received_bytes_total",
+	[METRIC_ERROR_SEND] = "battle_errors_total{type=\"send\"}",
+	[METRIC_ERROR_RECV] = "battle_errors_total{type=\"recv\"}",
+	[METRIC_ERROR_DISCONNECT] = "battle_errors_total{type=\"disconnect\"}",
+	[METRIC_ERROR_TIMEOUT] = "battle_errors_total{type=\"timeout\"}",
+	[METRIC_ERROR_ACCEPT] = "battle_errors_total{type=\"accept\"}",
+	[METRIC_ERROR_RULES] = "battle_errors_total{type=\"rules\"}"
+};
+static const char *histogram_names[NUM_HISTOGRAMS] = {
+	[HISTOGRAM_TURN] = "battle_turn_seconds",
+	[HISTOGRAM_RENDER] = "battle_render_seconds"
+};
+
+// Durations of one kind seen by one thread
+struct histogram {
+	_Atomic uint64_t buckets[HISTOGRAM_BUCKETS + 1];  // last one is +Inf
+	_Atomic uint64_t sum;                             // nanoseconds
+};
+
+// Metrics of one thread; only that thread writes to it, so updates are
+// plain relaxed loads and stores without any locked instruction
+struct metrics_shard {
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t metrics[NUM_METRICS];
+	struct histogram histograms[NUM_HISTOGRAMS];
+	struct metrics_shard *next;
+};
+
+static _Thread_local struct metrics_shard *local_shard;
+static _Atomic(struct metrics_shard *) shards;  // shards of all threads
+
+// PRE: -
+// POST: Shard of the calling thread, created on first use; NULL if memory
+//       could not be allocated
+static struct metrics_shard *get_shard(void) {
+	struct metrics_shard *shard = local_shard;
+	if (shard != NULL) {
+		return shard;
+	}
+	shard = aligned_alloc(CACHE_LINE_SIZE, sizeof(*shard));
+	if (shard == NULL) {
+		return NULL;
+	}
+	memset(shard, 0, sizeof(*shard));
+	// Publish lock-free to the thread serving the metrics
+	shard->next = atomic_load(&shards);
+	while (!atomic_compare_exchange_weak(&shards, &shard->next, shard));
+	local_shard = shard;
+	return shard;
+}
+
+// PRE: Value owned by the calling thread and amount to add
+// POST: Amount added; readers see either the old or the new value
+static void add_owned(_Atomic uint64_t *value, const uint64_t amount) {
+	atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount,
+	                      memory_order_relaxed);
+}
+
+// PRE: Metric and amount to add (negative for gauges going down)
+// POST: Amount added to the calling thread's copy of the metric
+void metrics_add(const enum METRIC metric, const int64_t amount) {
+	struct metrics_shard *shard = get_shard();
+	if (shard != NULL) {
+		add_owned(&shard->metrics[metric], (uint64_t)amount);
+	}
+}
+
+// PRE: Histogram and start time of the section (see now_ns)
+// POST: Duration of the section until now added to the calling thread's
+//       copy of the histogram
+void metrics_observe(const enum HISTOGRAM histogram, const uint64_t start) {
+	const uint64_t duration = now_ns() - start;
+	struct metrics_shard *shard = get_shard();
+	if (shard == NULL) {
+		return;
+	}
+	struct histogram *h = &shard->histograms[histogram];
+	int i = 0;
+	while (i < HISTOGRAM_BUCKETS && duration > bucket_bounds[i]) {
+		++i;
+	}
+	add_owned(&h->buckets[i], 1);
+	add_owned(&h->sum, duration);
+}
+
+// PRE: Metric
+// POST: Sum of the metric over all threads
+static uint64_t sum_metric(const enum METRIC metric) {
+	uint64_t sum = 0;
+	const struct metrics_shard *shard;
+	for (shard = atomic_load(&shards); shard != NULL; shard = shard->next) {
+		sum += atomic_load_explicit(&shard->metrics[metric], memory_order_relaxed);
+	}
+	return sum;
+}
+
+// PRE: Buffer of METRICS_RESPONSE_SIZE bytes and turns per second measured
+//      by the serving thread
+// POST: All metrics written to buffer in Prometheus text format; returns
+//       their length
+static int format_metrics(char *buf, const double turns_per_second) {
+	int len = 0;
+	int i, j;
+	const struct metrics_shard *shard;
+
+	len += snprintf(buf + len, METRICS_RESPONSE_SIZE - len,
+	    "# TYPE battle_active_sessions gauge\n"
+	    "# TYPE battle_turns_total counter\n"
+	    "# TYPE battle_sent_bytes_total counter\n"
+	    "# TYPE battle_received_bytes_total counter\n"
+	    "# TYPE battle_errors_total counter\n");
+	for (i = 0; i < NUM_METRICS; ++i) {
+		len += snprintf(buf + len, METRICS_RESPONSE_SIZE - len, "%s %lld\n",
+		                metric_names[i], (long long)(int64_t)sum_metric(i));
+	}
+	len += snprintf(buf + len, METRICS_RESPONSE_SIZE - len,
+	                "# TYPE battle_turns_per_second gauge\n"
+	                "battle_turns_per_second %.2f\n", turns_per_second);
+
+	for (i = 0; i < NUM_HISTOGRAMS; ++i) {
+		uint64_t buckets[HISTOGRAM_BUCKETS + 1] = {0};
+		uint64_t sum = 0;
+		for (shard = atomic_load(&shards); shard != NULL; shard = shard->next) {
+			const struct histogram *h = &shard->histograms[i];
+			for (j = 0; j <= HISTOGRAM_BUCKETS; ++j) {
+				buckets[j] += atomic_load_explicit(&h->buckets[j], memory_order_relaxed);
+			}
+			sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+		}
+		len += snprintf(buf + len, METRICS_RESPONSE_SIZE - len, "# TYPE %s histogram\n",
+		                histogram_names[i]);
+		// Prometheus buckets are cumulative
+		uint64_t count = 0;
+		for (j = 0; j < HISTOGRAM_BUCKETS; ++j) {
+			count += buckets[j];
+			len += snprintf(buf + len, METRICS_RESPONSE_SIZE - len,
+			                "%s_bucket{le=\"%s\"} %llu\n", histogram_names[i],
+			                bucket_labels[j], (unsigned long long)count);
+		}
+		count += buckets[HISTOGRAM_BUCKETS];
+		len += snprintf(buf + len, METRICS_RESPONSE_SIZE - len,
+		                "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n",
+		                histogram_names[i], (unsigned long long)count,
+		                histogram_names[i], sum / 1e9,
+		                histogram_names[i], (unsigned long long)count);
+	}
+	return len;
+}
+
+// PRE: Socket of a scraper that connected
+// POST: Request read and answered with the metrics; socket closed
+static void answer_scraper(const int socket, const double turns_per_second) {
+	static char response[METRICS_RESPONSE_SIZE];
+	static char body[METRICS_RESPONSE_SIZE];
+	char request[1024];
+	int len = 0;
+	int bytes;
+
+	// Slow scrapers only hold up this thread, and only for a moment
+	const struct timeval timeout = {METRICS_TIMEOUT_S, 0};
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// Read request header
+	while (len < (int)sizeof(request) - 1 &&
+	       (bytes = recv(socket, request + len, sizeof(request) - 1 - len, 0)) > 0) {
+		len += bytes;
+		request[len] = '\0';
+		if (strstr(request, "\r\n\r\n") != NULL) {
+			break;
+		}
+	}
+	request[len] = '\0';
+
+	if (strncmp(request, "GET /metrics ", 13) == 0) {
+		const int body_len = format_metrics(body, turns_per_second);
+		len = snprintf(response, sizeof(response),
+		    "HTTP/1.0 200 OK\r\n"
+		    "Content-Type: text/plain; version=0.0.4\r\n"
+		    "Content-Length: %d\r\n\r\n%s", body_len, body);
+	} else {
+		len = snprintf(response, sizeof(response),
+		    "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+	}
+	if (len >= (int)sizeof(response)) {
+		len = sizeof(response) - 1;
+	}
+	// Not send_full: the endpoint's own traffic is not counted
+	int begin = 0;
+	while (begin < len &&
+	       (bytes = send(socket, response + begin, len - begin, MSG_NOSIGNAL)) > 0) {
+		begin += bytes;
+	}
+	close(socket);
+}
+
+// PRE: Listening socket of the endpoint
+// POST: Answers scrapers and measures turns per second forever
+static void *serve_metrics(void *arg) {
+	const int socket_listen = *(int *)arg;
+	free(arg);
+	uint64_t last_time = now_ns();
+	uint64_t last_turns = sum_metric(METRIC_TURNS);
+	double turns_per_second = 0.0;
+
+	for (;;) {
+		struct pollfd fd = {socket_listen, POLLIN, 0};
+		const int ready = poll(&fd, 1, 1000);
+
+		// Rate over the last second (or more, while answering)
+		const uint64_t now = now_ns();
+		if (now - last_time >= 1000000000u) {
+			const uint64_t turns = sum_metric(METRIC_TURNS);
+			turns_per_second = (turns - last_turns) * 1e9 / (now - last_time);
+			last_time = now;
+			last_turns = turns;
+		}
+		if (ready <= 0) {
+			continue;
+		}
+		const int socket = accept(socket_listen, NULL, NULL);
+		if (socket < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				log_errno("metrics", "Failed to accept scraper");
+			}
+			continue;
+		}
+		answer_scraper(socket, turns_per_second);
+	}
+	return NULL;
+}
+
+// PRE: -
+// POST: Metrics served in Prometheus text format on 127.0.0.1 (port
+//       METRICS_PORT or BATTLE_METRICS_PORT) by a thread of their own;
+//       returns 0 on success, 1 otherwise
+int metrics_start(void) {
+	const char *port = getenv(METRICS_PORT_ENV);
+	if (port == NULL) {
+		port = METRICS_PORT;
+	}
+	int status;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *bind_address;
+
+	// Only reachable from this machine
+	if ((status = getaddrinfo("127.0.0.1", port, &hints, &bind_address))) {
+		log_write(LOG_ERROR, "metrics", "getaddrinfo: %s", gai_strerror(status));
+		return 1;
+	}
+	int *socket_listen = malloc(sizeof(*socket_listen));
+	if (socket_listen == NULL) {
+		freeaddrinfo(bind_address);
+		return 1;
+	}
+	*socket_listen = socket(bind_address->ai_family, bind_address->ai_socktype,
+	                        bind_address->ai_protocol);
+	if (*socket_listen < 0) {
+		log_errno("metrics", "Failed to create socket");
+		freeaddrinfo(bind_address);
+		free(socket_listen);
+		return 1;
+	}
+	const int reuse = 1;
+	setsockopt(*socket_listen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if (bind(*socket_listen, bind_address->ai_addr, bind_address->ai_addrlen) < 0 ||
+	    listen(*socket_listen, SOMAXCONN) < 0) {
+		log_errno("metrics", "Failed to listen");
+		freeaddrinfo(bind_address);
+		close(*socket_listen);
+		free(socket_listen);
+		return 1;
+	}
+	freeaddrinfo(bind_address);
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, serve_metrics, socket_listen) != 0) {
+		log_write(LOG_ERROR, "metrics", "Could not start thread");
+		close(*socket_listen);
+		free(socket_listen);
+		return 1;
+	}
+	pthread_detach(thread);
+	log_write(chatter_level(), "metrics", "Metrics served at http://127.0.0.1:%s/metrics", port);
+	return 0;
+}
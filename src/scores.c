@@ -0,0 +1,229 @@
+#include "log.h"
+#include "scores.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define KEY_EMPTY (0u)
+#define KEY_BUSY (1u)
+
+// PRE: Name of player
+// POST: FNV-1a hash of name, never KEY_EMPTY or KEY_BUSY
+static uint32_t hash_name(const char *name) {
+	uint32_t hash = 2166136261u;
+	int i;
+	for (i = 0; i < NAME_SIZE && name[i] != '\0'; ++i) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash | 0x80000000u;
+}
+
+// PRE: Results word of a record
+// POST: Number of wins, losses or draws
+static int count_results(const uint64_t results, enum RESULT result) {
+	return (int)((results >> (result * RESULT_BITS)) & RESULT_MASK);
+}
+
+// PRE: Results word of a record
+// POST: Score (2 per win, 1 per draw)
+static int results_to_score(const uint64_t results) {
+	return 2 * count_results(results, RESULT_WIN) + count_results(results, RESULT_DRAW);
+}
+
+// PRE: Store mapped for writing whose file nobody else has open
+// POST: Records a crashed process left half created are emptied
+static void recover(struct score_store *store) {
+	int i;
+	for (i = 0; i < SCORE_STORE_CAPACITY; ++i) {
+		struct score_record *r = &store->records[i];
+		if (atomic_load(&r->key) == KEY_BUSY) {
+			memset(r->name, 0, NAME_SIZE);
+			atomic_store(&r->results, 0);
+			atomic_store(&r->key, KEY_EMPTY);
+		}
+	}
+}
+
+// PRE: Store, path of the file (created if missing unless read only) and
+//      whether the store is only read
+// POST: Returns 0 on success, 1 otherwise
+int score_store_open(struct score_store *store, const char *path, const int read_only) {
+	store->file_size = sizeof(struct score_header) +
+	                   SCORE_STORE_CAPACITY * sizeof(struct score_record);
+	store->fd = read_only ? open(path, O_RDONLY) : open(path, O_RDWR | O_CREAT, 0644);
+	if (store->fd < 0) {
+		log_errno("scores", "Could not open score store");
+		return 1;
+	}
+	// Writers hold a shared lock for as long as the store is open, so an
+	// exclusive one proves that nobody is creating a record right now
+	int is_alone = 0;
+	if (!read_only) {
+		is_alone = (flock(store->fd, LOCK_EX | LOCK_NB) == 0);
+		if (!is_alone && errno != EWOULDBLOCK) {
+			log_errno("scores", "Could not lock score store");
+			close(store->fd);
+			return 1;
+		}
+	}
+	struct stat st;
+	if (fstat(store->fd, &st) != 0) {
+		log_errno("scores", "Could not open score store");
+		close(store->fd);
+		return 1;
+	}
+	const int is_new = (st.st_size == 0 && !read_only);
+	// Sparse file: pages are only allocated for records in use
+	if ((is_new && ftruncate(store->fd, store->file_size) != 0) ||
+	    (!is_new && (size_t)st.st_size != store->file_size)) {
+		log_write(LOG_ERROR, "scores", "Score store %s has an unexpected size", path);
+		close(store->fd);
+		return 1;
+	}
+	void *memory = mmap(NULL, store->file_size,
+	                    read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+	                    MAP_SHARED, store->fd, 0);
+	if (memory == MAP_FAILED) {
+		log_errno("scores", "Could not map score store");
+		close(store->fd);
+		return 1;
+	}
+	store->header = memory;
+	store->records = (struct score_record *)((char *)memory + sizeof(struct score_header));
+
+	if (!read_only && (is_new || store->header->magic == 0)) {
+		store->header->capacity = SCORE_STORE_CAPACITY;
+		store->header->version = SCORE_STORE_VERSION;
+		store->header->magic = SCORE_STORE_MAGIC;
+	} else if (store->header->magic != 0 &&  // not set up yet when read only
+	           (store->header->magic != SCORE_STORE_MAGIC ||
+	            store->header->version != SCORE_STORE_VERSION ||
+	            store->header->capacity != SCORE_STORE_CAPACITY)) {
+		log_write(LOG_ERROR, "scores", "%s is not a score store of this version", path);
+		munmap(memory, store->file_size);
+		close(store->fd);
+		return 1;
+	}
+
+	// Recover from a crash while a record was created, but only if no
+	// other process could be creating one
+	if (is_alone) {
+		recover(store);
+	}
+	if (!read_only) {
+		flock(store->fd, LOCK_SH);
+	}
+
+	// Records cleared above no longer count
+	if (is_alone) {
+		uint64_t count = 0;
+		int i;
+		for (i = 0; i < SCORE_STORE_CAPACITY; ++i) {
+			const uint32_t key = atomic_load(&store->records[i].key);
+			count += (key != KEY_EMPTY && key != KEY_BUSY);
+		}
+		atomic_store(&store->header->count, count);
+	}
+	return 0;
+}
+
+// PRE: Opened store
+// POST: Changes flushed to the file and store closed (which releases its
+//       lock)
+void score_store_close(struct score_store *store) {
+	msync(store->header, store->file_size, MS_SYNC);
+	munmap(store->header, store->file_size);
+	close(store->fd);
+}
+
+// PRE: Opened store and name of player; safe from any thread
+// POST: Index of record of the player (created if needed), -1 if the
+//       store is full
+int score_store_lookup(struct score_store *store, const char *name) {
+	char padded[NAME_SIZE] = {0};
+	strncpy(padded, name, NAME_SIZE - 1);
+	const uint32_t hash = hash_name(padded);
+
+	// Open addressing with linear probing
+	uint32_t i = hash & (SCORE_STORE_CAPACITY - 1);
+	for (;;) {
+		struct score_record *r = &store->records[i];
+		uint32_t key = atomic_load_explicit(&r->key, memory_order_acquire);
+		if (key == KEY_EMPTY) {
+			if (atomic_load(&store->header->count) >= SCORE_STORE_CAPACITY / 4 * 3) {
+				return -1;  // full
+			}
+			// Claim slot, write name and publish it
+			if (atomic_compare_exchange_strong(&r->key, &key, KEY_BUSY)) {
+				memcpy(r->name, padded, NAME_SIZE);
+				atomic_store(&r->results, 0);
+				atomic_fetch_add(&store->header->count, 1);
+				atomic_store_explicit(&r->key, hash, memory_order_release);
+				return (int)i;
+			}
+		}
+		while (key == KEY_BUSY) {
+			// Another thread is creating this record
+			key = atomic_load_explicit(&r->key, memory_order_acquire);
+		}
+		if (key == hash && memcmp(r->name, padded, NAME_SIZE) == 0) {
+			return (int)i;
+		}
+		if (key != KEY_EMPTY) {
+			i = (i + 1) & (SCORE_STORE_CAPACITY - 1);
+		}
+	}
+}
+
+// PRE: Opened store and index of record
+// POST: Score of player (2 per win, 1 per draw)
+int score_store_score(const struct score_store *store, const int record) {
+	return results_to_score(atomic_load(&store->records[record].results));
+}
+
+// PRE: Opened store, index of record and result of a game; safe from any
+//      thread
+// POST: Result added atomically
+void score_store_record(struct score_store *store, const int record,
+                        enum RESULT result) {
+	atomic_fetch_add(&store->records[record].results,
+	                 UINT64_C(1) << (result * RESULT_BITS));
+}
+
+// PRE: Opened store and buffer for up to LEADERBOARD_SIZE entries
+// POST: Returns number of entries, best player first; the records are
+//       scanned on every call, so results written by other processes
+//       since the store was opened are included
+int score_store_top(struct score_store *store, struct score_entry *entries) {
+	int len = 0;
+	int i, j;
+	for (i = 0; i < SCORE_STORE_CAPACITY; ++i) {
+		const struct score_record *r = &store->records[i];
+		const uint32_t key = atomic_load_explicit(&r->key, memory_order_acquire);
+		if (key == KEY_EMPTY || key == KEY_BUSY) {
+			continue;
+		}
+		const uint64_t results = atomic_load(&r->results);
+		const int score = results_to_score(results);
+		if (len == LEADERBOARD_SIZE && score <= entries[len - 1].score) {
+			continue;
+		}
+		// Insert in order, the last entry drops out of a full board
+		j = (len < LEADERBOARD_SIZE) ? len++ : len - 1;
+		for (; j > 0 && entries[j - 1].score < score; --j) {
+			entries[j] = entries[j - 1];
+		}
+		memcpy(entries[j].name, r->name, NAME_SIZE);
+		entries[j].score = score;
+		entries[j].wins = count_results(results, RESULT_WIN);
+		entries[j].losses = count_results(results, RESULT_LOSS);
+		entries[j].draws = count_results(results, RESULT_DRAW);
+	}
+	return len;
+}
@@ -0,0 +1,524 @@
+#include "battle.h"
+#include "clock.h"
+#include "communicate.h"
+#include "log.h"
+#include "matchmaking.h"
+#include "metrics.h"
+#include "scores.h"
+#include "server.h"
+#include "session.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+
+// Results of all players
+static struct score_store store;
+
+// Size of the message each side sends in a phase
+static const int message_size[] = {
+	[PHASE_BOARD] = BOARD_SIZE * sizeof(char),
+	[PHASE_MAP] = BOARD_SIZE * sizeof(int),
+	[PHASE_SHOT] = 2 * sizeof(int),
+	[PHASE_REPLY] = sizeof(char)
+};
+
+// Thread accepting players; it never waits for them to say anything
+struct acceptor {
+	pthread_t thread;
+	int socket_listen;
+	struct match_queue *arrivals;
+};
+
+// Player that joined but has not sent its whole name yet
+struct arrival {
+	int socket;
+	int len;            // bytes of name received
+	uint64_t deadline;  // monotonic time the name must be complete by
+	char name[NAME_SIZE];
+};
+
+// Thread relaying the games of its own sessions
+struct game_thread {
+	pthread_t thread;
+	struct matchmaker *matchmaker;
+	struct match_queue *arrivals;  // accepted players, shared by all threads
+	struct arrival *lobby;         // players of this thread sending their name
+	int num_arrivals;
+	struct session_pool pool;
+	struct session **sessions;
+	struct pollfd *fds;
+	int num_sessions;
+};
+
+// PRE: Socket
+// POST: Socket never blocks
+static void set_nonblocking(const int socket) {
+	fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+}
+
+// PRE: Acceptor
+// POST: Queues every joining player for a game thread to read its name
+static void *accept_players(void *arg) {
+	struct acceptor *a = arg;
+	for (;;) {
+		struct ticket t = {-1, -1, 0};
+		t.socket = accept(a->socket_listen, NULL, NULL);
+		if (t.socket < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				metrics_add(METRIC_ERROR_ACCEPT, 1);
+				log_errno("accept", "Failed to accept client");
+			}
+			continue;
+		}
+		if (match_queue_push(a->arrivals, &t) != 0) {
+			log_write(LOG_WARN, "accept", "Arrivals queue full, rejecting player");
+			close(t.socket);
+		}
+	}
+	return NULL;
+}
+
+// PRE: Game thread and index of a player in its lobby
+// POST: Player removed from the lobby (replaced by the last one)
+static void leave_lobby(struct game_thread *t, const int i) {
+	t->lobby[i] = t->lobby[--t->num_arrivals];
+}
+
+// PRE: Game thread and index of a player in its lobby with pending input
+// POST: Name received as far as sent; once complete, the player is queued
+//       for matchmaking in the bucket of its record and leaves the lobby
+static void read_name(struct game_thread *t, const int i) {
+	struct arrival *a = &t->lobby[i];
+	const int bytes = recv(a->socket, a->name + a->len, NAME_SIZE - a->len, 0);
+	if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+		metrics_add(bytes == 0 ? METRIC_ERROR_DISCONNECT : METRIC_ERROR_RECV, 1);
+		close(a->socket);
+		leave_lobby(t, i);
+		return;
+	}
+	if (bytes < 0 || (a->len += bytes) < NAME_SIZE) {
+		return;
+	}
+	metrics_add(METRIC_BYTES_RECEIVED, NAME_SIZE);
+	// Players introduce themselves first; their record decides the bucket
+	a->name[NAME_SIZE - 1] = '\0';
+	struct ticket ticket = {a->socket, score_store_lookup(&store, a->name), 0};
+	if (ticket.record < 0) {
+		log_write(LOG_WARN, "accept", "Score store full, rejecting player");
+		close(a->socket);
+	} else {
+		ticket.score = score_store_score(&store, ticket.record);
+		if (matchmaker_enqueue(t->matchmaker, &ticket) != 0) {
+			log_write(LOG_WARN, "accept", "Matchmaking queue full, rejecting player");
+			close(a->socket);
+		}
+	}
+	leave_lobby(t, i);
+}
+
+// PRE: Session of a game that just ended
+// POST: Result of both players stored
+static void record_results(const struct session *s) {
+	if (s->ship_count[SELF] == 0 && s->ship_count[OPPONENT] == 0) {
+		score_store_record(&store, s->record[SELF], RESULT_DRAW);
+		score_store_record(&store, s->record[OPPONENT], RESULT_DRAW);
+	} else if (s->ship_count[SELF] == 0) {
+		score_store_record(&store, s->record[SELF], RESULT_LOSS);
+		score_store_record(&store, s->record[OPPONENT], RESULT_WIN);
+	} else {
+		score_store_record(&store, s->record[SELF], RESULT_WIN);
+		score_store_record(&store, s->record[OPPONENT], RESULT_LOSS);
+	}
+	log_fields("shots=%d parts_left=%d,%d", s->shots[SELF], s->ship_count[SELF],
+	           s->ship_count[OPPONENT]);
+	log_write(LOG_DEBUG, "match", "Match over");
+}
+
+// PRE: Session and side that sent the message now complete in its buffer
+// POST: Game state of session updated; returns 1 if the message breaks the
+//       rules, 0 otherwise
+static int track_message(struct session *s, const int side) {
+	const int other = 1 - side;
+	int sunk_id;
+
+	switch (s->phase[side]) {
+		case PHASE_BOARD:
+		memcpy(s->board[side], s->buf[side], BOARD_SIZE * sizeof(char));
+		s->phase[side] = PHASE_MAP;
+		break;
+
+		case PHASE_MAP:
+		memcpy(s->map[side], s->buf[side], BOARD_SIZE * sizeof(int));
+		if (!is_valid_fleet(s->board[side], s->map[side])) {
+			return 1;
+		}
+		s->phase[side] = PHASE_SHOT;
+		s->turn_start[side] = now_ns();
+		break;
+
+		case PHASE_SHOT:
+		if (s->shots[side] > s->shots[other]) {
+			return 1;  // one shot per round, also after a forfeit sent for it
+		}
+		memcpy(s->coords[side], s->buf[side], 2 * sizeof(int));
+		const int r = s->coords[side][0] - 1;
+		const int c = s->coords[side][1] - 1;
+		if (s->coords[side][0] != FORFEIT && (!is_inside(r, c) || apply_shot(r * BOARD_LENGTH + c,
+		        s->board[other], s->map[other], &s->ship_count[other],
+		        s->ships[other], &sunk_id) == -1)) {
+			return 1;
+		}
+		s->shots[side]++;
+		metrics_add(METRIC_TURNS, 1);
+		metrics_observe(HISTOGRAM_TURN, s->turn_start[side]);
+		s->turn_start[side] = now_ns();
+		// Both sides fire once per round; the game ends with a round, and
+		// so do forfeits (a side out of game time)
+		if (s->shots[SELF] == s->shots[OPPONENT]) {
+			if (s->coords[SELF][0] == FORFEIT) {
+				s->ship_count[SELF] = 0;
+			}
+			if (s->coords[OPPONENT][0] == FORFEIT) {
+				s->ship_count[OPPONENT] = 0;
+			}
+		}
+		if (s->shots[SELF] == s->shots[OPPONENT] &&
+		    (s->ship_count[SELF] == 0 || s->ship_count[OPPONENT] == 0)) {
+			s->phase[SELF] = PHASE_REPLY;
+			s->phase[OPPONENT] = PHASE_REPLY;
+			record_results(s);
+		}
+		break;
+
+		default:  // PHASE_REPLY
+		s->reply[side] = s->buf[side][0];
+		if (s->reply[other] == 0) {
+			break;  // wait for other reply
+		}
+		if (s->reply[side] == 'y' && s->reply[other] == 'y') {
+			session_reset(s);  // rematch
+		} else {
+			s->closing = 1;
+		}
+	}
+	return 0;
+}
+
+// PRE: Session and side
+// POST: Seconds the side may stay silent, as its own clock allows for the
+//       message it owes; 0 while the game waits for the other side
+static int silence_limit(const struct session *s, const int side) {
+	const int other = 1 - side;
+	switch (s->phase[side]) {
+		case PHASE_BOARD:
+		return PLACE_LIMIT_S + PEER_GRACE_S;
+
+		case PHASE_MAP:  // sent once the other board arrived
+		return (s->phase[other] >= PHASE_MAP) ? PLACE_LIMIT_S + PEER_GRACE_S : 0;
+
+		case PHASE_SHOT:  // both fire once per round
+		return (s->phase[other] >= PHASE_SHOT && s->shots[side] <= s->shots[other])
+		    ? TURN_LIMIT_S + PEER_GRACE_S : 0;
+
+		default:  // PHASE_REPLY
+		return (s->reply[side] == 0) ? REMATCH_LIMIT_S + PEER_GRACE_S : 0;
+	}
+}
+
+// PRE: Session and side whose message is now complete in its buffer
+// POST: Message tracked, and the other side's clock started if it owes the
+//       next message from now on; returns 1 if the message breaks the
+//       rules, 0 otherwise
+static int complete_message(struct session *s, const int side) {
+	const int other = 1 - side;
+	const int owed = (silence_limit(s, other) > 0);
+	const int status = track_message(s, side);
+	if (!owed) {
+		s->last_active[other] = now_ns();
+	}
+	return status;
+}
+
+// PRE: Session and current time
+// POST: Sides silent past their limit forfeit: a shot or rematch reply
+//       they owe is sent for them (FORFEIT, 'n'), so that the other side
+//       learns of it as from a player's own forfeit; returns 1 if the
+//       session has to end instead (silent while placing ships or in the
+//       middle of a message, results recorded), 0 otherwise
+static int went_silent(struct session *s, const uint64_t now) {
+	int side, silent[2] = {0, 0}, end = 0;
+	for (side = SELF; side <= OPPONENT; ++side) {
+		const int limit = silence_limit(s, side);
+		if (limit == 0 || now <= s->last_active[side] + limit * 1000000000ull) {
+			continue;
+		}
+		silent[side] = 1;
+		end |= (s->buf_len[side] != 0 || s->phase[side] < PHASE_SHOT);
+		metrics_add(METRIC_ERROR_TIMEOUT, 1);
+		log_fields("side=%d phase=%d", side, s->phase[side]);
+		log_write(LOG_WARN, "timeout", "Player went silent and forfeits");
+	}
+	if (end) {
+		if (s->phase[SELF] != PHASE_REPLY) {
+			for (side = SELF; side <= OPPONENT; ++side) {
+				if (silent[side]) {
+					s->ship_count[side] = 0;
+				}
+			}
+			record_results(s);
+		}
+		return 1;
+	}
+	for (side = SELF; side <= OPPONENT; ++side) {
+		if (!silent[side]) {
+			continue;
+		}
+		if (s->phase[side] == PHASE_SHOT) {
+			const int forfeit[2] = {FORFEIT, FORFEIT};
+			memcpy(s->buf[side], forfeit, sizeof(forfeit));
+		} else {
+			s->buf[side][0] = 'n';
+		}
+		s->expected[side] = message_size[s->phase[side]];
+		s->buf_len[side] = s->expected[side];
+		s->last_active[side] = now;
+		complete_message(s, side);  // a forfeit never breaks the rules
+	}
+	return 0;
+}
+
+// PRE: Session of which a side just left
+// POST: If the other side owes a message and was silent for about as long
+//       as its limit, it forfeits and the results are recorded: the side
+//       that left most likely gave up on it by its own clock
+static void left_over_silence(struct session *s, const int side) {
+	const int other = 1 - side;
+	const int limit = silence_limit(s, other);
+	if (s->phase[SELF] != PHASE_REPLY && limit > 0 &&
+	    now_ns() + PEER_GRACE_S * 1000000000ull > s->last_active[other] + limit * 1000000000ull) {
+		s->ship_count[other] = 0;
+		log_fields("side=%d phase=%d", other, s->phase[other]);
+		log_write(LOG_WARN, "timeout", "Player went silent and forfeits");
+		record_results(s);
+	}
+}
+
+// PRE: Session and events of both sockets
+// POST: Messages received, checked and forwarded to the other side;
+//       returns 1 if the session is over, 0 otherwise
+static int relay(struct session *s, const short *revents) {
+	int side;
+	for (side = SELF; side <= OPPONENT; ++side) {
+		const int other = 1 - side;
+		int bytes;
+
+		// Receive rest of the message sent by this side
+		if (s->buf_len[side] == 0) {
+			s->expected[side] = message_size[s->phase[side]];
+		}
+		if (s->buf_len[side] < s->expected[side] &&
+		    (revents[side] & (POLLIN | POLLHUP | POLLERR))) {
+			bytes = recv(s->socket[side], s->buf[side] + s->buf_len[side],
+			             s->expected[side] - s->buf_len[side], 0);
+			if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+				metrics_add(bytes == 0 ? METRIC_ERROR_DISCONNECT : METRIC_ERROR_RECV, 1);
+				left_over_silence(s, side);
+				return 1;  // player left
+			}
+			if (bytes > 0) {
+				metrics_add(METRIC_BYTES_RECEIVED, bytes);
+				s->last_active[side] = now_ns();
+				s->buf_len[side] += bytes;
+				if (s->buf_len[side] == s->expected[side] && complete_message(s, side) != 0) {
+					metrics_add(METRIC_ERROR_RULES, 1);
+					log_fields("side=%d phase=%d", side, s->phase[side]);
+					log_write(LOG_WARN, "rules", "Player broke the rules, ending match");
+					return 1;
+				}
+			}
+		}
+		// Forward complete message to other side
+		if (s->buf_len[side] > 0 && s->buf_len[side] == s->expected[side]) {
+			bytes = send(s->socket[other], s->buf[side] + s->sent[side],
+			             s->expected[side] - s->sent[side], MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+				metrics_add(METRIC_ERROR_SEND, 1);
+				return 1;
+			}
+			if (bytes > 0) {
+				metrics_add(METRIC_BYTES_SENT, bytes);
+			}
+			if (bytes > 0 && (s->sent[side] += bytes) == s->expected[side]) {
+				s->buf_len[side] = 0;
+				s->sent[side] = 0;
+			}
+		}
+	}
+	return s->closing && s->buf_len[SELF] == 0 && s->buf_len[OPPONENT] == 0;
+}
+
+// PRE: Game thread
+// POST: Starts sessions for paired players and relays them until they end
+static void *run_games(void *arg) {
+	struct game_thread *t = arg;
+	int i;
+
+	for (;;) {
+		// Take accepted players while there is room; they have
+		// SERVER_NAME_TIMEOUT_S to introduce themselves
+		struct ticket arrival;
+		while (t->num_arrivals < SERVER_ARRIVALS_MAX &&
+		       match_queue_pop(t->arrivals, &arrival) == 0) {
+			struct arrival *a = &t->lobby[t->num_arrivals++];
+			set_nonblocking(arrival.socket);
+			a->socket = arrival.socket;
+			a->len = 0;
+			a->deadline = now_ns() + SERVER_NAME_TIMEOUT_S * 1000000000ull;
+		}
+
+		// Take new pairs while there is room
+		struct ticket first, second;
+		while (t->pool.live < t->pool.capacity &&
+		       matchmaker_pair(t->matchmaker, &first, &second)) {
+			struct session *s = session_alloc(&t->pool);
+			s->socket[SELF] = first.socket;
+			s->socket[OPPONENT] = second.socket;
+			s->record[SELF] = first.record;
+			s->record[OPPONENT] = second.record;
+			set_nonblocking(first.socket);
+			set_nonblocking(second.socket);
+			// Introduce players to each other
+			int side;
+			for (side = SELF; side <= OPPONENT; ++side) {
+				memcpy(s->buf[side], store.records[s->record[side]].name, NAME_SIZE);
+				s->buf_len[side] = NAME_SIZE;
+				s->expected[side] = NAME_SIZE;
+			}
+			s->last_active[SELF] = s->last_active[OPPONENT] = now_ns();
+			t->sessions[t->num_sessions++] = s;
+		}
+
+		for (i = 0; i < t->num_sessions; ++i) {
+			const struct session *s = t->sessions[i];
+			int side;
+			for (side = SELF; side <= OPPONENT; ++side) {
+				const int other = 1 - side;
+				struct pollfd *fd = &t->fds[2 * i + side];
+				fd->fd = s->socket[side];
+				fd->events = 0;
+				fd->revents = 0;
+				if (s->buf_len[side] == 0 || s->buf_len[side] < s->expected[side]) {
+					fd->events |= POLLIN;
+				}
+				if (s->buf_len[other] > 0 && s->buf_len[other] == s->expected[other]) {
+					fd->events |= POLLOUT;
+				}
+			}
+		}
+		// Players in the lobby come after the sessions
+		struct pollfd *lobby_fds = t->fds + 2 * t->num_sessions;
+		for (i = 0; i < t->num_arrivals; ++i) {
+			lobby_fds[i].fd = t->lobby[i].socket;
+			lobby_fds[i].events = POLLIN;
+			lobby_fds[i].revents = 0;
+		}
+		if (poll(t->fds, 2 * t->num_sessions + t->num_arrivals, SERVER_POLL_MS) < 0) {
+			if (errno != EINTR) {
+				log_errno("poll", "Poll failed");
+			}
+			continue;
+		}
+
+		// Backwards, so that removed players and sessions can be replaced by
+		// the last one
+		const uint64_t now = now_ns();
+		for (i = t->num_arrivals - 1; i >= 0; --i) {
+			if (lobby_fds[i].revents != 0) {
+				read_name(t, i);
+			} else if (now > t->lobby[i].deadline) {
+				metrics_add(METRIC_ERROR_TIMEOUT, 1);
+				close(t->lobby[i].socket);
+				leave_lobby(t, i);
+			}
+		}
+		for (i = t->num_sessions - 1; i >= 0; --i) {
+			struct session *s = t->sessions[i];
+			const short revents[2] = {t->fds[2 * i].revents, t->fds[2 * i + 1].revents};
+			if (((revents[SELF] != 0 || revents[OPPONENT] != 0) && relay(s, revents)) ||
+			    went_silent(s, now)) {
+				close(s->socket[SELF]);
+				close(s->socket[OPPONENT]);
+				session_free(&t->pool, s);
+				t->sessions[i] = t->sessions[--t->num_sessions];
+			}
+		}
+	}
+	return NULL;
+}
+
+// PRE: Listening socket, number of game threads and of skill buckets
+// POST: Pairs joining players and relays their games, ending those where
+//       a player stays silent longer than its clock allows; only returns
+//       on error (1)
+int run_server(const int socket_listen, const int num_game_threads,
+               const int num_buckets) {
+	assert(0 < num_game_threads && num_game_threads <= SERVER_GAME_THREADS_MAX);
+
+	// Peers leaving must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	if (score_store_open(&store, SCORE_STORE_PATH, 0) != 0) {
+		return 1;
+	}
+
+	struct matchmaker matchmaker;
+	static struct match_queue arrivals;
+	if (matchmaker_init(&matchmaker, num_buckets) != 0 || match_queue_init(&arrivals) != 0) {
+		log_write(LOG_ERROR, "start", "Could not allocate matchmaking queue");
+		return 1;
+	}
+
+	static struct game_thread game_threads[SERVER_GAME_THREADS_MAX];
+	int i;
+	for (i = 0; i < num_game_threads; ++i) {
+		struct game_thread *t = &game_threads[i];
+		t->matchmaker = &matchmaker;
+		t->arrivals = &arrivals;
+		t->num_arrivals = 0;
+		t->num_sessions = 0;
+		t->lobby = malloc(SERVER_ARRIVALS_MAX * sizeof(*t->lobby));
+		t->sessions = malloc(SERVER_SESSIONS_MAX * sizeof(*t->sessions));
+		t->fds = malloc((2 * SERVER_SESSIONS_MAX + SERVER_ARRIVALS_MAX) * sizeof(*t->fds));
+		if (t->lobby == NULL || t->sessions == NULL || t->fds == NULL ||
+		    session_pool_init(&t->pool, SERVER_SESSIONS_MAX) != 0) {
+			log_write(LOG_ERROR, "start", "Could not allocate sessions");
+			return 1;
+		}
+		if (pthread_create(&t->thread, NULL, run_games, t) != 0) {
+			log_write(LOG_ERROR, "start", "Could not start game thread");
+			return 1;
+		}
+	}
+
+	struct acceptor acceptors[SERVER_ACCEPTORS];
+	for (i = 0; i < SERVER_ACCEPTORS; ++i) {
+		acceptors[i].socket_listen = socket_listen;
+		acceptors[i].arrivals = &arrivals;
+		if (pthread_create(&acceptors[i].thread, NULL, accept_players, &acceptors[i]) != 0) {
+			log_write(LOG_ERROR, "start", "Could not start acceptor thread");
+			return 1;
+		}
+	}
+	log_fields("game_threads=%d buckets=%d", num_game_threads, num_buckets);
+	log_write(LOG_INFO, "start", "Server running with %d game thread(s), waiting for players...",
+	          num_game_threads);
+
+	// Acceptors never finish
+	for (i = 0; i < SERVER_ACCEPTORS; ++i) {
+		pthread_join(acceptors[i].thread, NULL);
+	}
+	return 1;
+}
@@ -0,0 +1,189 @@
+#include "metrics.h"
+#include "session.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Unused slots are chained through their first bytes
+struct free_slot {
+	struct free_slot *next;
+};
+
+// PRE: Pool and maximum number of sessions
+// POST: All memory of the pool allocated upfront; returns 0 on success,
+//       1 otherwise
+int session_pool_init(struct session_pool *pool, const size_t capacity) {
+	pool->slot_size = (sizeof(struct session) + CACHE_LINE_SIZE - 1) /
+	                  CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+	pool->capacity = capacity;
+	pool->live = 0;
+	pool->peak = 0;
+	pool->free_list = NULL;
+	pool->memory = aligned_alloc(CACHE_LINE_SIZE, capacity * pool->slot_size);
+	if (pool->memory == NULL) {
+		return 1;
+	}
+	// Touch every page now so that memory use does not grow during games
+	memset(pool->memory, 0, capacity * pool->slot_size);
+
+	// Chain slots so that the lowest address is handed out first
+	size_t i;
+	for (i = capacity; i > 0; --i) {
+		struct free_slot *slot = (struct free_slot *)
+		    (pool->memory + (i - 1) * pool->slot_size);
+		slot->next = pool->free_list;
+		pool->free_list = slot;
+	}
+	return 0;
+}
+
+// PRE: Initialized pool without live sessions
+// POST: Memory of pool released
+void session_pool_destroy(struct session_pool *pool) {
+	free(pool->memory);
+	pool->memory = NULL;
+	pool->free_list = NULL;
+	pool->capacity = 0;
+}
+
+// PRE: Initialized pool
+// POST: Cache-line aligned session in O(1), reset for a new game;
+//       NULL if pool is exhausted
+struct session *session_alloc(struct session_pool *pool) {
+	struct free_slot *slot = pool->free_list;
+	if (slot == NULL) {
+		return NULL;
+	}
+	pool->free_list = slot->next;
+	if (++pool->live > pool->peak) {
+		pool->peak = pool->live;
+	}
+	struct session *s = (struct session *)slot;
+	s->socket[SELF] = -1;
+	s->socket[OPPONENT] = -1;
+	s->buf_len[SELF] = 0;
+	s->buf_len[OPPONENT] = 0;
+	s->sent[SELF] = 0;
+	s->sent[OPPONENT] = 0;
+	s->closing = 0;
+	session_reset(s);
+	metrics_add(METRIC_SESSIONS, 1);
+	return s;
+}
+
+// PRE: Session handed out by the same pool
+// POST: Session returned to pool in O(1)
+void session_free(struct session_pool *pool, struct session *s) {
+	struct free_slot *slot = (struct free_slot *)s;
+	slot->next = pool->free_list;
+	pool->free_list = slot;
+	pool->live--;
+	metrics_add(METRIC_SESSIONS, -1);
+}
+
+// PRE: Session
+// POST: Boards, maps, ships and counters reset for a new game; sockets
+//       and buffers are kept
+void session_reset(struct session *s) {
+	int side;
+	for (side = SELF; side <= OPPONENT; ++side) {
+		init(s->board[side], s->map[side]);
+		memcpy(s->ships[side], player_ships, sizeof(s->ships[side]));
+		int i;
+		for (i = 0; i < NUM_SHIPS; ++i) {
+			s->ships[side][i].hits_taken = 0;
+		}
+		s->ship_count[side] = NUM_SHIP_PARTS;
+		s->phase[side] = PHASE_BOARD;
+		s->shots[side] = 0;
+		s->reply[side] = 0;
+	}
+}
+
+// PRE: Session whose fleets were both placed and exchanged
+// POST: Placements recorded, shot history cleared
+void snapshot_placements(struct session *s) {
+	struct snapshot *snap = &s->snapshot;
+	int side;
+	for (side = SELF; side <= OPPONENT; ++side) {
+		int i;
+		// First cell of a ship found row by row is its origin
+		for (i = BOARD_SIZE - 1; i >= 0; --i) {
+			const int ship_id = s->map[side][i];
+			if (ship_id >= 0) {
+				snap->origin[side][ship_id] = (unsigned char)i;
+			}
+		}
+		for (i = 0; i < NUM_SHIPS; ++i) {
+			const int origin = snap->origin[side][i];
+			snap->vertical[side][i] = !(origin % BOARD_LENGTH + 1 < BOARD_LENGTH &&
+			                            s->map[side][origin + 1] == i);
+		}
+		snap->num_shots[side] = 0;
+	}
+}
+
+// PRE: Session and cell shot by the given side
+// POST: Shot appended to history of side
+void snapshot_shot(struct session *s, const int side, const int index) {
+	struct snapshot *snap = &s->snapshot;
+	if (snap->num_shots[side] < BOARD_SIZE) {
+		snap->shots[side][snap->num_shots[side]++] = (unsigned char)index;
+	}
+}
+
+// PRE: Session with recorded placements
+// POST: Number of turns completed by both sides
+int snapshot_turn(const struct session *s) {
+	const struct snapshot *snap = &s->snapshot;
+	return (snap->num_shots[SELF] < snap->num_shots[OPPONENT]) ?
+	       snap->num_shots[SELF] : snap->num_shots[OPPONENT];
+}
+
+// PRE: Session with recorded placements
+// POST: Checksum of both fleets, equal on both sides of the game
+uint32_t snapshot_checksum(const struct session *s) {
+	const struct snapshot *snap = &s->snapshot;
+	uint32_t checksum = 0;
+	int side;
+	for (side = SELF; side <= OPPONENT; ++side) {
+		// FNV-1a per fleet, combined independent of which side is which
+		uint32_t hash = 2166136261u;
+		int i;
+		for (i = 0; i < NUM_SHIPS; ++i) {
+			hash = (hash ^ snap->origin[side][i]) * 16777619u;
+			hash = (hash ^ snap->vertical[side][i]) * 16777619u;
+		}
+		checksum ^= hash;
+	}
+	return checksum;
+}
+
+// PRE: Session with recorded placements and a turn it already completed
+// POST: Boards, maps, ships and history rebuilt as they were after turn
+void snapshot_restore(struct session *s, const int turn) {
+	struct snapshot *snap = &s->snapshot;
+	session_reset(s);
+
+	int side, i, k;
+	for (side = SELF; side <= OPPONENT; ++side) {
+		for (i = 0; i < NUM_SHIPS; ++i) {
+			const int step = snap->vertical[side][i] ? BOARD_LENGTH : 1;
+			for (k = 0; k < s->ships[side][i].length; ++k) {
+				const int index = snap->origin[side][i] + k * step;
+				s->board[side][index] = SHIP;
+				s->map[side][index] = i;
+			}
+		}
+	}
+	// Replay history; each side shoots at the board of the other one
+	int sunk_id;
+	for (side = SELF; side <= OPPONENT; ++side) {
+		const int other = 1 - side;
+		for (i = 0; i < turn; ++i) {
+			apply_shot(snap->shots[side][i], s->board[other], s->map[other],
+			           &s->ship_count[other], s->ships[other], &sunk_id);
+		}
+		snap->num_shots[side] = turn;
+	}
+}
@@ -0,0 +1,331 @@
+#include "battle.h"
+#include "bot.h"
+#include "clock.h"
+#include "engine.h"
+#include "log.h"
+#include "session.h"
+#include "tournament.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_SHOT (-1)
+
+// One side of the tournament: an external engine or the built-in bot
+struct contender {
+	struct engine engine;
+	int external;
+	const char *name;
+	struct bot *bots;  // built-in bot only, one per game
+	int wins;
+	int rule_breaks;
+};
+
+// One game of the tournament; the first side plays SELF of its session,
+// the second side OPPONENT
+struct match {
+	struct session *s;
+	int ready[2];  // fleet placed
+	int shot[2];   // board index fired this round, NO_SHOT if none
+	int over;
+};
+
+static struct contender sides[2];
+static int draws = 0;
+static long total_shots = 0;
+
+// PRE: Board and ship map after init(), fleet as sent by an engine
+//      (orientation, row and column of every ship in order of ids)
+// POST: Ships placed as given; returns 0 if the fleet is legal, 1 otherwise
+static int place_fleet(char *board, int *map, const char *text) {
+	int i, k;
+	for (i = 0; i < NUM_SHIPS; ++i) {
+		const int length = player_ships[i].length;
+		char orientation;
+		int row, col, consumed;
+		if (sscanf(text, " %c %d %d%n", &orientation, &row, &col, &consumed) != 3) {
+			return 1;
+		}
+		text += consumed;
+		// zero-based
+		row = row - 1;
+		col = col - 1;
+		if (orientation != HORIZONTAL && orientation != VERTICAL) {
+			return 1;
+		}
+		const int step = (orientation == HORIZONTAL) ? 1 : BOARD_LENGTH;
+		const int end_row = row + (step == BOARD_LENGTH) * (length - 1);
+		const int end_col = col + (step == 1) * (length - 1);
+		if (!is_inside(row, col) || !is_inside(end_row, end_col) ||
+		    is_overlap(board, length, row, col, orientation)) {
+			return 1;
+		}
+		for (k = 0; k < length; ++k) {
+			board[row * BOARD_LENGTH + col + k * step] = SHIP;
+			map[row * BOARD_LENGTH + col + k * step] = i;
+		}
+	}
+	return !is_valid_fleet(board, map);
+}
+
+// PRE: Side, game, board index it shot, result of apply_shot() and the
+//      ship map of the board shot at
+// POST: Side told the result of its shot
+static void report_shot(const int side, const int game, const int index,
+                        const int is_hit, const int sunk_id, const int *map) {
+	struct contender *c = &sides[side];
+	if (!c->external) {
+		bot_observe(&c->bots[game], index, is_hit, sunk_id, map);
+		return;
+	}
+	const int row = index / BOARD_LENGTH + 1;
+	const int col = index % BOARD_LENGTH + 1;
+	if (sunk_id < 0) {
+		engine_request(&c->engine, "result %d %d %d %s", game, row, col,
+		               is_hit ? "hit" : "miss");
+		return;
+	}
+	// Reveal where the destroyed ship lay, like the map does for players
+	int ship_row, ship_col;
+	enum ORIENTATIONS o;
+	locate_ship(map, sunk_id, &ship_row, &ship_col, &o);
+	engine_request(&c->engine, "result %d %d %d sunk %d %c %d %d", game, row, col,
+	               sunk_id, o, ship_row + 1, ship_col + 1);
+}
+
+// PRE: Game whose fleets are placed and of which a side lost all ship
+//      parts (or forfeited)
+// POST: Result counted and told to the engines
+static void finish_match(struct match *m, const int game) {
+	const int lost[2] = {m->s->ship_count[SELF] == 0, m->s->ship_count[OPPONENT] == 0};
+	int side;
+	m->over = 1;
+	total_shots += m->s->shots[SELF] + m->s->shots[OPPONENT];
+	if (lost[SELF] && lost[OPPONENT]) {
+		draws++;
+	} else {
+		sides[lost[SELF] ? OPPONENT : SELF].wins++;
+	}
+	for (side = SELF; side <= OPPONENT; ++side) {
+		if (sides[side].external) {
+			engine_request(&sides[side].engine, "end %d %s", game,
+			               (lost[SELF] && lost[OPPONENT]) ? "draw" :
+			               lost[side] ? "loss" : "win");
+		}
+	}
+}
+
+// PRE: Side and all games, with new requests sent to an external side
+// POST: Fleets of the side placed; games it sent no legal fleet for are not
+//       ready
+static void collect_fleets(const int side, struct match *matches, const int games) {
+	struct contender *c = &sides[side];
+	int g;
+	if (!c->external) {
+		unsigned int seed = (unsigned int)now_ns() ^ side;
+		for (g = 0; g < games; ++g) {
+			place_random_ships(matches[g].s->board[side], matches[g].s->map[side], &seed);
+			matches[g].ready[side] = 1;
+			bot_reset(&c->bots[g]);
+		}
+		return;
+	}
+	char line[ENGINE_LINE_SIZE];
+	while (engine_reply(&c->engine, line, sizeof(line)) == 0) {
+		int consumed;
+		if (sscanf(line, "fleet %d%n", &g, &consumed) != 1 || g < 0 || g >= games ||
+		    matches[g].ready[side]) {
+			continue;  // not an answer to any request
+		}
+		struct session *s = matches[g].s;
+		matches[g].ready[side] = (place_fleet(s->board[side], s->map[side],
+		                                      line + consumed) == 0);
+	}
+}
+
+// PRE: Side and all games, with shoot requests sent to an external side
+// POST: Shots of the side for every running game; games it sent no shot
+//       inside the board for keep NO_SHOT
+static void collect_shots(const int side, struct match *matches, const int games) {
+	struct contender *c = &sides[side];
+	int g;
+	if (!c->external) {
+		for (g = 0; g < games; ++g) {
+			if (!matches[g].over) {
+				matches[g].shot[side] = bot_choose(&c->bots[g]);
+			}
+		}
+		return;
+	}
+	char line[ENGINE_LINE_SIZE];
+	while (engine_reply(&c->engine, line, sizeof(line)) == 0) {
+		int row, col;
+		if (sscanf(line, "shot %d %d %d", &g, &row, &col) != 3 || g < 0 || g >= games ||
+		    matches[g].over || matches[g].shot[side] != NO_SHOT) {
+			continue;  // not an answer to any request
+		}
+		if (is_inside(row - 1, col - 1)) {
+			matches[g].shot[side] = (row - 1) * BOARD_LENGTH + col - 1;
+		}
+	}
+}
+
+// PRE: Running game with the shots of both sides for this round
+// POST: Both shots applied like shoot() does; a side without a legal shot
+//       forfeits once the round is complete
+static void play_round(struct match *m, const int game) {
+	struct session *s = m->s;
+	int broke[2] = {0, 0};
+	int side;
+	for (side = SELF; side <= OPPONENT; ++side) {
+		const int other = 1 - side;
+		const int index = m->shot[side];
+		int sunk_id = -1;
+		const int is_hit = (index == NO_SHOT) ? -1 :
+		    apply_shot(index, s->board[other], s->map[other], &s->ship_count[other],
+		               s->ships[other], &sunk_id);
+		m->shot[side] = NO_SHOT;
+		if (is_hit == -1) {
+			broke[side] = 1;
+			sides[side].rule_breaks++;
+			continue;
+		}
+		s->shots[side]++;
+		report_shot(side, game, index, is_hit, sunk_id, s->map[other]);
+	}
+	for (side = SELF; side <= OPPONENT; ++side) {
+		if (broke[side]) {
+			s->ship_count[side] = 0;
+		}
+	}
+	if (s->ship_count[SELF] == 0 || s->ship_count[OPPONENT] == 0) {
+		finish_match(m, game);
+	}
+}
+
+// PRE: Number of games and engines of both sides (see engine_open); NULL
+//      as second engine plays that side with the built-in bot
+// POST: All games played at once, in rounds of one batch per engine, with
+//       the rules of shoot(); results printed; returns 0 on success, 1 if
+//       an engine could not be started
+int run_tournament(const int games, const char *first, const char *second) {
+	const char *specs[2] = {first, second};
+	struct session_pool pool;
+	struct match *matches = calloc(games, sizeof(*matches));
+	int status = 1;
+	int side, g;
+
+	if (matches == NULL || session_pool_init(&pool, games) != 0) {
+		log_write(LOG_ERROR, "tournament", "Could not allocate games");
+		free(matches);
+		return 1;
+	}
+	for (g = 0; g < games; ++g) {
+		matches[g].s = session_alloc(&pool);
+		matches[g].shot[SELF] = NO_SHOT;
+		matches[g].shot[OPPONENT] = NO_SHOT;
+	}
+	// An engine that is gone fails its writes instead of ending the game
+	signal(SIGPIPE, SIG_IGN);
+	for (side = SELF; side <= OPPONENT; ++side) {
+		struct contender *c = &sides[side];
+		c->external = (specs[side] != NULL);
+		c->name = c->external ? c->engine.name : "bot";
+		c->bots = c->external ? NULL : calloc(games, sizeof(*c->bots));
+		if (c->external ? engine_open(&c->engine, specs[side]) != 0 : c->bots == NULL) {
+			log_write(LOG_ERROR, "tournament", "Could not start %s", c->external ? specs[side] : "bot");
+			goto cleanup;
+		}
+	}
+
+	// Ask every engine for all fleets at once, then wait for the answers
+	const uint64_t start = now_ns();
+	for (side = SELF; side <= OPPONENT; ++side) {
+		if (sides[side].external) {
+			for (g = 0; g < games; ++g) {
+				engine_request(&sides[side].engine, "new %d", g);
+			}
+			engine_go(&sides[side].engine);
+		}
+	}
+	for (side = SELF; side <= OPPONENT; ++side) {
+		collect_fleets(side, matches, games);
+	}
+	int running = 0;
+	for (g = 0; g < games; ++g) {
+		for (side = SELF; side <= OPPONENT; ++side) {
+			if (!matches[g].ready[side]) {
+				matches[g].s->ship_count[side] = 0;
+				sides[side].rule_breaks++;
+			}
+		}
+		if (matches[g].ready[SELF] && matches[g].ready[OPPONENT]) {
+			running++;
+		} else {
+			finish_match(&matches[g], g);
+		}
+	}
+
+	// Every round is one batch per engine; results of a round travel with
+	// the requests of the next
+	while (running > 0) {
+		for (side = SELF; side <= OPPONENT; ++side) {
+			if (sides[side].external) {
+				for (g = 0; g < games; ++g) {
+					if (!matches[g].over) {
+						engine_request(&sides[side].engine, "shoot %d", g);
+					}
+				}
+				engine_go(&sides[side].engine);
+			}
+		}
+		for (side = SELF; side <= OPPONENT; ++side) {
+			collect_shots(side, matches, games);
+		}
+		for (g = 0; g < games; ++g) {
+			if (!matches[g].over) {
+				play_round(&matches[g], g);
+				running -= matches[g].over;
+			}
+		}
+	}
+	// Deliver the last results
+	for (side = SELF; side <= OPPONENT; ++side) {
+		if (sides[side].external && engine_go(&sides[side].engine) == 0) {
+			char line[ENGINE_LINE_SIZE];
+			while (engine_reply(&sides[side].engine, line, sizeof(line)) == 0);
+		}
+	}
+	const double seconds = (now_ns() - start) / 1e9;
+
+	log_flush_console();  // engine errors come before the results
+	printf("%s vs %s: %d games in %.2f s, %.1f games/s, %.1f shots per game side\n",
+	       sides[SELF].name, sides[OPPONENT].name, games, seconds, games / seconds,
+	       (double)total_shots / (2 * games));
+	for (side = SELF; side <= OPPONENT; ++side) {
+		const struct contender *c = &sides[side];
+		printf("%-*s won %d (%.1f%%), broke the rules %d times", ENGINE_NAME_SIZE / 2,
+		       c->name, c->wins, 100.0 * c->wins / games, c->rule_breaks);
+		if (c->external && c->engine.batches > 0) {
+			printf(", %.3f ms per batch", c->engine.busy_ns / 1e6 / c->engine.batches);
+		}
+		printf("\n");
+	}
+	printf("%-*s %d (%.1f%%)\n", ENGINE_NAME_SIZE / 2, "draws", draws, 100.0 * draws / games);
+	status = 0;
+
+cleanup:
+	for (side = SELF; side <= OPPONENT; ++side) {
+		if (sides[side].external) {
+			engine_close(&sides[side].engine);
+		}
+		free(sides[side].bots);
+	}
+	for (g = 0; g < games; ++g) {
+		session_free(&pool, matches[g].s);
+	}
+	session_pool_destroy(&pool);
+	free(matches);
+	return status;
+}
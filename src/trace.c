@@ -0,0 +1,166 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// One traced section
+struct trace_event {
+	const char *name;
+	uint64_t start;
+	uint64_t duration;
+};
+
+// Events of one thread; only that thread writes to it
+struct trace_buffer {
+	struct trace_buffer *next;
+	int tid;
+	atomic_int count;
+	int dropped;
+	struct trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+static _Thread_local struct trace_buffer *local_buffer;
+static _Atomic(struct trace_buffer *) buffers;  // buffers of all threads
+static atomic_int next_tid = 1;
+static pthread_once_t dump_once = PTHREAD_ONCE_INIT;
+static int signal_pipe[2] = {-1, -1};  // signals caught, for dump_on_signal
+
+// PRE: Signal that terminates the process
+// POST: Signal passed on to dump_on_signal; only async-signal-safe calls
+static void catch_signal(const int sig) {
+	const int saved_errno = errno;
+	const unsigned char c = (unsigned char)sig;
+	if (write(signal_pipe[1], &c, 1) != 1) {
+		// Nothing else is safe to do here
+	}
+	errno = saved_errno;
+}
+
+// PRE: -
+// POST: Trace dumped once a signal was caught, then the process terminated
+//       by that signal as if it had never been caught, so servers can be
+//       traced too
+static void *dump_on_signal(void *arg) {
+	(void)arg;
+	unsigned char sig;
+	while (read(signal_pipe[0], &sig, 1) != 1) {
+		if (errno != EINTR) {
+			return NULL;
+		}
+	}
+	trace_dump();
+	signal(sig, SIG_DFL);
+	raise(sig);
+	return NULL;
+}
+
+// PRE: -
+// POST: Trace gets dumped when the process exits or is interrupted;
+//       handlers the program installed itself are left alone
+static void register_dump(void) {
+	atexit(trace_dump);
+	if (pipe(signal_pipe) != 0) {
+		return;
+	}
+	pthread_t watcher;
+	if (pthread_create(&watcher, NULL, dump_on_signal, NULL) != 0) {
+		return;
+	}
+	pthread_detach(watcher);
+	const int signals[] = {SIGINT, SIGTERM};
+	unsigned int i;
+	for (i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i) {
+		struct sigaction action;
+		if (sigaction(signals[i], NULL, &action) == 0 && action.sa_handler == SIG_DFL) {
+			memset(&action, 0, sizeof(action));
+			action.sa_handler = catch_signal;
+			sigemptyset(&action.sa_mask);
+			sigaction(signals[i], &action, NULL);
+		}
+	}
+}
+
+// PRE: Static name of the traced section and its start time
+// POST: Section recorded in the buffer of the calling thread; dropped if
+//       the buffer is full
+void trace_event(const char *name, const uint64_t start) {
+	const uint64_t end = now_ns();
+	struct trace_buffer *buffer = local_buffer;
+
+	if (buffer == NULL) {
+		// First event of this thread: allocate once and publish lock-free
+		buffer = calloc(1, sizeof(*buffer));
+		if (buffer == NULL) {
+			return;
+		}
+		buffer->tid = atomic_fetch_add(&next_tid, 1);
+		buffer->next = atomic_load(&buffers);
+		while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer));
+		local_buffer = buffer;
+		pthread_once(&dump_once, register_dump);
+	}
+	const int count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+	if (count == TRACE_BUFFER_EVENTS) {
+		buffer->dropped++;
+		return;
+	}
+	struct trace_event *event = &buffer->events[count];
+	event->name = name;
+	event->start = start;
+	event->duration = end - start;
+	// Publish event to the dumping thread
+	atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+// PRE: -
+// POST: Events of all threads written as Chrome trace JSON to the file
+//       named by BATTLE_TRACE_FILE (battle-trace-<pid>.json by default)
+void trace_dump(void) {
+	char path[64];
+	const char *file = getenv(TRACE_FILE_ENV);
+	if (file == NULL) {
+		snprintf(path, sizeof(path), "battle-trace-%d.json", (int)getpid());
+		file = path;
+	}
+	const int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return;
+	}
+	char line[256];
+	int len = snprintf(line, sizeof(line), "{\"traceEvents\":[");
+	const char *separator = "\n";
+	int ok = write(fd, line, len) == len;
+
+	const struct trace_buffer *buffer;
+	for (buffer = atomic_load(&buffers); buffer != NULL && ok; buffer = buffer->next) {
+		const int count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+		int i;
+		for (i = 0; i < count && ok; ++i) {
+			const struct trace_event *event = &buffer->events[i];
+			len = snprintf(line, sizeof(line),
+			    "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+			    "\"pid\":%d,\"tid\":%d}", separator, event->name,
+			    event->start / 1000.0, event->duration / 1000.0,
+			    (int)getpid(), buffer->tid);
+			ok = write(fd, line, len) == len;
+			separator = ",\n";
+		}
+		if (buffer->dropped > 0) {
+			fprintf(stderr, "Trace: thread %d dropped %d events\n",
+			        buffer->tid, buffer->dropped);
+		}
+	}
+	len = snprintf(line, sizeof(line), "\n]}\n");
+	ok = ok && write(fd, line, len) == len;
+	close(fd);
+	if (!ok) {
+		fprintf(stderr, "Trace: could not write %s\n", file);
+	}
+}
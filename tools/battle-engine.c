@@ -0,0 +1,196 @@
+#include "battle.h"
+#include "bot.h"
+#include "clock.h"
+#include "engine.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Engine parameters
+#define ENGINE_GAMES_MAX (1 << 16)  // games are told apart by ids below this
+#define ENGINE_GAMES_MIN (64)       // games allocated at first
+
+// What the engine keeps of a game
+struct engine_game {
+	struct bot bot;
+	int map[BOARD_SIZE];  // cells of destroyed opponent ships, -1 elsewhere
+};
+
+static struct engine_game *games = NULL;
+static int num_games = 0;
+static unsigned int seed;
+
+// PRE: Game id
+// POST: State of the game, allocated on first use; NULL if the id is out of
+//       range or memory ran out
+static struct engine_game *get_game(const int id) {
+	if (id < 0 || id >= ENGINE_GAMES_MAX) {
+		return NULL;
+	}
+	if (id >= num_games) {
+		int size = (num_games > 0) ? num_games : ENGINE_GAMES_MIN;
+		while (size <= id) {
+			size *= 2;
+		}
+		struct engine_game *grown = realloc(games, size * sizeof(*games));
+		if (grown == NULL) {
+			return NULL;
+		}
+		memset(grown + num_games, 0, (size - num_games) * sizeof(*games));
+		games = grown;
+		num_games = size;
+	}
+	return &games[id];
+}
+
+// PRE: Output of the engine and a request of the arbiter
+// POST: Request handled, replies written (not flushed); returns 1 on quit,
+//       0 otherwise
+static int handle_request(FILE *out, const char *line) {
+	char word[16];
+	int id, row, col, ship, ship_row, ship_col, i;
+	char result[8], o;
+	struct engine_game *g;
+
+	if (sscanf(line, "%15s", word) != 1) {
+		return 0;
+	}
+	if (strcmp(word, "battle") == 0) {
+		fprintf(out, "ready density-bot\n");
+		fflush(out);
+	} else if (strcmp(word, "new") == 0 && sscanf(line, "new %d", &id) == 1 &&
+	           (g = get_game(id)) != NULL) {
+		bot_reset(&g->bot);
+		char board[BOARD_SIZE];
+		int map[BOARD_SIZE];
+		init(board, map);
+		for (i = 0; i < BOARD_SIZE; ++i) {
+			g->map[i] = -1;
+		}
+		place_random_ships(board, map, &seed);
+		fprintf(out, "fleet %d", id);
+		for (i = 0; i < NUM_SHIPS; ++i) {
+			enum ORIENTATIONS orientation;
+			locate_ship(map, i, &row, &col, &orientation);
+			fprintf(out, " %c %d %d", orientation, row + 1, col + 1);
+		}
+		fprintf(out, "\n");
+	} else if (strcmp(word, "shoot") == 0 && sscanf(line, "shoot %d", &id) == 1 &&
+	           (g = get_game(id)) != NULL) {
+		const int index = bot_choose(&g->bot);
+		fprintf(out, "shot %d %d %d\n", id, index / BOARD_LENGTH + 1,
+		        index % BOARD_LENGTH + 1);
+	} else if (strcmp(word, "result") == 0) {
+		const int n = sscanf(line, "result %d %d %d %7s %d %c %d %d", &id, &row, &col,
+		                     result, &ship, &o, &ship_row, &ship_col);
+		if (n < 4 || (g = get_game(id)) == NULL || !is_inside(row - 1, col - 1)) {
+			return 0;
+		}
+		const int index = (row - 1) * BOARD_LENGTH + col - 1;
+		if (strcmp(result, "sunk") == 0 && n == 8 && ship >= 0 && ship < NUM_SHIPS) {
+			const int step = (o == HORIZONTAL) ? 1 : BOARD_LENGTH;
+			const int origin = (ship_row - 1) * BOARD_LENGTH + ship_col - 1;
+			for (i = 0; i < player_ships[ship].length; ++i) {
+				if (origin + i * step >= 0 && origin + i * step < BOARD_SIZE) {
+					g->map[origin + i * step] = ship;
+				}
+			}
+			bot_observe(&g->bot, index, 1, ship, g->map);
+		} else {
+			bot_observe(&g->bot, index, strcmp(result, "miss") != 0, -1, g->map);
+		}
+	} else if (strcmp(word, "go") == 0) {
+		fprintf(out, "done\n");
+		fflush(out);
+	} else if (strcmp(word, "end") == 0 && sscanf(line, "end %d", &id) == 1 &&
+	           id >= 0 && id < num_games) {
+		// Nothing is kept after the end of a game
+		bot_reset(&games[id].bot);
+		for (i = 0; i < BOARD_SIZE; ++i) {
+			games[id].map[i] = -1;
+		}
+	} else if (strcmp(word, "quit") == 0) {
+		return 1;
+	}
+	return 0;
+}
+
+// PRE: Requests of an arbiter and where to reply
+// POST: Requests served until quit or end of input
+static void serve(FILE *in, FILE *out) {
+	char line[ENGINE_LINE_SIZE];
+	setvbuf(out, NULL, _IOFBF, ENGINE_BUFFER_SIZE);
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (handle_request(out, line)) {
+			break;
+		}
+	}
+	fflush(out);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 2) {
+		fprintf(stderr, "Usage: ./battle-engine [socket]\n"
+		                "       (serves standard input without a socket)\n");
+		return 1;
+	}
+	const char *cache_path = getenv(BOT_CACHE_ENV);
+	if (bot_cache_init(cache_path) != 0) {
+		return 1;
+	}
+	seed = (unsigned int)now_ns() ^ (unsigned int)getpid();
+	if (argc == 1) {
+		serve(stdin, stdout);
+		if (cache_path != NULL) {
+			bot_cache_save(cache_path);
+		}
+		bot_cache_destroy();
+		return 0;
+	}
+
+	// Serve one arbiter after the other, keeping what was learnt
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path is too long\n");
+		return 1;
+	}
+	strcpy(address.sun_path, argv[1]);
+	const int socket_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(argv[1]);
+	if (socket_listen < 0 ||
+	    bind(socket_listen, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+	    listen(socket_listen, SOMAXCONN) != 0) {
+		perror("Could not listen on socket");
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	for (;;) {
+		const int fd = accept(socket_listen, NULL, NULL);
+		if (fd < 0) {
+			continue;
+		}
+		FILE *in = fdopen(fd, "r");
+		FILE *out = (in != NULL) ? fdopen(dup(fd), "w") : NULL;
+		if (out == NULL) {
+			perror("Could not serve arbiter");
+			if (in != NULL) {
+				fclose(in);
+			} else {
+				close(fd);
+			}
+			continue;
+		}
+		serve(in, out);
+		fclose(in);
+		fclose(out);
+		if (cache_path != NULL) {
+			bot_cache_save(cache_path);
+		}
+	}
+}
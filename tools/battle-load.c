@@ -0,0 +1,359 @@
+#include "battle.h"
+#include "bot.h"
+#include "clock.h"
+#include "communicate.h"
+#include "input.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// Load parameters
+#define LOAD_CONNECTIONS_MAX (1024)
+#define LOAD_SAMPLES_MAX (1 << 14)  // latencies kept per connection
+#define LOAD_TIMEOUT_S (10)         // longest wait for the other side
+#define LOAD_STACK_SIZE (1 << 16)
+
+// Errors counted by the load clients
+enum LOAD_ERROR {
+	LOAD_ERROR_CONNECT,
+	LOAD_ERROR_SEND,
+	LOAD_ERROR_RECV,      // includes timeouts and the host leaving
+	LOAD_ERROR_PROTOCOL,  // invalid fleet or shot received
+	NUM_LOAD_ERRORS
+};
+
+static const char *error_names[NUM_LOAD_ERRORS] = {
+	[LOAD_ERROR_CONNECT] = "connect",
+	[LOAD_ERROR_SEND] = "send",
+	[LOAD_ERROR_RECV] = "recv",
+	[LOAD_ERROR_PROTOCOL] = "protocol"
+};
+
+// Latencies in microseconds, sampled uniformly once there are too many
+struct samples {
+	uint32_t values[LOAD_SAMPLES_MAX];
+	uint64_t seen;
+};
+
+// One simulated player; only its own thread touches it until joined
+struct load_client {
+	pthread_t thread;
+	int id;
+	unsigned int seed;
+	int games;
+	int shots;
+	int errors[NUM_LOAD_ERRORS];
+	struct bot bot;
+	struct samples handshake;  // connect until opponent name received
+	struct samples turn;       // shot sent until opponent shot received
+};
+
+// Settings shared by all clients
+static char host_ip[INET_ADDRSTRLEN];
+static double shot_rate = 0.0;  // shots per second and client, 0 = unlimited
+static int use_bot = 0;         // shoot like the bot instead of at random
+static atomic_int stop = 0;
+
+// PRE: Samples, latency in nanoseconds and random generator state
+// POST: Latency kept if there is room, otherwise with the probability that
+//       keeps all latencies equally likely to be kept
+static void add_sample(struct samples *s, const uint64_t ns, unsigned int *seed) {
+	const uint32_t us = (uint32_t)(ns / 1000);
+	if (s->seen < LOAD_SAMPLES_MAX) {
+		s->values[s->seen] = us;
+	} else {
+		const uint64_t k = (((uint64_t)rand_r(seed) << 31) | rand_r(seed)) % (s->seen + 1);
+		if (k < LOAD_SAMPLES_MAX) {
+			s->values[k] = us;
+		}
+	}
+	s->seen++;
+}
+
+// PRE: Absolute monotonic time in nanoseconds
+// POST: Returns once that time has passed
+static void sleep_until(const uint64_t deadline) {
+	const struct timespec ts = {deadline / 1000000000u, deadline % 1000000000u};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+// PRE: Client, connected socket and session of a new game
+// POST: Fleets exchanged and one game played with random (or bot) shots at
+//       the shot rate; returns 0 once the game is over, 1 on error
+static int play_game(struct load_client *c, const int socket, struct session *s) {
+	int order[BOARD_SIZE];  // cells in the order this client shoots them
+	int i;
+
+	place_random_ships(s->board[SELF], s->map[SELF], &c->seed);
+	if (send_full(socket, s->board[SELF], BOARD_SIZE * sizeof(char)) < 0 ||
+	    send_full(socket, s->map[SELF], BOARD_SIZE * sizeof(int)) < 0) {
+		c->errors[LOAD_ERROR_SEND]++;
+		return 1;
+	}
+	if (recv_full(socket, s->board[OPPONENT], BOARD_SIZE * sizeof(char)) <= 0 ||
+	    recv_full(socket, s->map[OPPONENT], BOARD_SIZE * sizeof(int)) <= 0) {
+		c->errors[LOAD_ERROR_RECV]++;
+		return 1;
+	}
+	if (!is_valid_fleet(s->board[OPPONENT], s->map[OPPONENT])) {
+		c->errors[LOAD_ERROR_PROTOCOL]++;
+		return 1;
+	}
+
+	// Random legal shots: every cell once, in shuffled order
+	for (i = 0; i < BOARD_SIZE; ++i) {
+		order[i] = i;
+	}
+	for (i = BOARD_SIZE - 1; i > 0; --i) {
+		const int j = rand_r(&c->seed) % (i + 1);
+		const int tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	bot_reset(&c->bot);
+
+	uint64_t next_shot = now_ns();
+	int sunk_id;
+	for (i = 0; s->ship_count[SELF] > 0 && s->ship_count[OPPONENT] > 0; ++i) {
+		if (shot_rate > 0.0) {
+			sleep_until(next_shot);
+			next_shot += (uint64_t)(1e9 / shot_rate);
+		}
+		const int index = use_bot ? bot_choose(&c->bot) : order[i];
+		s->coords[SELF][0] = index / BOARD_LENGTH + 1;
+		s->coords[SELF][1] = index % BOARD_LENGTH + 1;
+		const int is_hit = apply_shot(index, s->board[OPPONENT], s->map[OPPONENT],
+		                              &s->ship_count[OPPONENT], s->ships[OPPONENT], &sunk_id);
+		bot_observe(&c->bot, index, is_hit, sunk_id, s->map[OPPONENT]);
+
+		const uint64_t start = now_ns();
+		if (send_full(socket, s->coords[SELF], sizeof(s->coords[SELF])) < 0) {
+			c->errors[LOAD_ERROR_SEND]++;
+			return 1;
+		}
+		if (recv_full(socket, s->coords[OPPONENT], sizeof(s->coords[OPPONENT])) <= 0) {
+			c->errors[LOAD_ERROR_RECV]++;
+			return 1;
+		}
+		add_sample(&c->turn, now_ns() - start, &c->seed);
+		c->shots++;
+
+		if (s->coords[OPPONENT][0] == FORFEIT) {
+			s->ship_count[OPPONENT] = 0;  // opponent ran out of game time
+			break;
+		}
+		const int r = s->coords[OPPONENT][0] - 1;
+		const int col = s->coords[OPPONENT][1] - 1;
+		if (!is_inside(r, col) || apply_shot(r * BOARD_LENGTH + col, s->board[SELF],
+		        s->map[SELF], &s->ship_count[SELF], s->ships[SELF], &sunk_id) == -1) {
+			c->errors[LOAD_ERROR_PROTOCOL]++;
+			return 1;
+		}
+	}
+	c->games++;
+	return 0;
+}
+
+// PRE: Client
+// POST: Joins the host and plays rematch after rematch until stopped
+static void *run_client(void *arg) {
+	struct load_client *c = arg;
+	const struct timeval timeout = {LOAD_TIMEOUT_S, 0};
+	struct session_pool pool;
+	int socket;
+
+	if (session_pool_init(&pool, 1) != 0) {
+		return NULL;
+	}
+	struct session *s = session_alloc(&pool);
+	if (s == NULL) {
+		session_pool_destroy(&pool);
+		return NULL;
+	}
+
+	const uint64_t start = now_ns();
+	if (join_host(host_ip, &socket) != 0) {
+		c->errors[LOAD_ERROR_CONNECT]++;
+		goto cleanup;
+	}
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	// Introduce ourselves like a player would
+	char name[NAME_SIZE] = {0}, opponent_name[NAME_SIZE];
+	snprintf(name, NAME_SIZE, "load%d", c->id);
+	if (send_full(socket, name, NAME_SIZE) < 0) {
+		c->errors[LOAD_ERROR_SEND]++;
+		goto disconnect;
+	}
+	if (recv_full(socket, opponent_name, NAME_SIZE) <= 0) {
+		c->errors[LOAD_ERROR_RECV]++;
+		goto disconnect;
+	}
+	add_sample(&c->handshake, now_ns() - start, &c->seed);
+
+	for (;;) {
+		if (play_game(c, socket, s) != 0) {
+			break;
+		}
+		// Keep playing until stopped
+		const char reply = atomic_load(&stop) ? 'n' : 'y';
+		char opponent_reply;
+		if (send_full(socket, &reply, sizeof(reply)) < 0) {
+			c->errors[LOAD_ERROR_SEND]++;
+			break;
+		}
+		if (recv_full(socket, &opponent_reply, sizeof(opponent_reply)) <= 0) {
+			c->errors[LOAD_ERROR_RECV]++;
+			break;
+		}
+		if (reply != 'y' || opponent_reply != 'y') {
+			break;
+		}
+		session_reset(s);
+	}
+disconnect:
+	close(socket);
+cleanup:
+	session_free(&pool, s);
+	session_pool_destroy(&pool);
+	return NULL;
+}
+
+// PRE: Array of latencies
+// POST: Sorted ascending
+static int compare_latencies(const void *a, const void *b) {
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// PRE: Clients after they finished, which samples to report and their name
+// POST: Percentiles of the samples of all clients printed
+static void print_percentiles(const struct load_client *clients, const int num_clients,
+                              const size_t offset, const char *name) {
+	size_t total = 0;
+	int i;
+	for (i = 0; i < num_clients; ++i) {
+		const struct samples *s = (const struct samples *)((const char *)&clients[i] + offset);
+		total += (s->seen < LOAD_SAMPLES_MAX) ? s->seen : LOAD_SAMPLES_MAX;
+	}
+	if (total == 0) {
+		printf("%-10s no samples\n", name);
+		return;
+	}
+	uint32_t *all = malloc(total * sizeof(*all));
+	if (all == NULL) {
+		return;
+	}
+	size_t len = 0;
+	for (i = 0; i < num_clients; ++i) {
+		const struct samples *s = (const struct samples *)((const char *)&clients[i] + offset);
+		const size_t kept = (s->seen < LOAD_SAMPLES_MAX) ? s->seen : LOAD_SAMPLES_MAX;
+		memcpy(all + len, s->values, kept * sizeof(*all));
+		len += kept;
+	}
+	qsort(all, total, sizeof(*all), compare_latencies);
+	printf("%-10s p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  p99.9 %8.3f ms  max %8.3f ms\n",
+	       name, all[total / 2] / 1000.0, all[total * 90 / 100] / 1000.0,
+	       all[total * 99 / 100] / 1000.0, all[total * 999 / 1000] / 1000.0,
+	       all[total - 1] / 1000.0);
+	free(all);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: ./battle-load <host> [connections] [seconds] [shots/s] [random|bot]\n"
+		                "       (shots/s per connection, 0 = as fast as possible)\n");
+		return 1;
+	}
+	const int num_clients = (argc >= 3) ? atoi(argv[2]) : 2;
+	const int seconds = (argc >= 4) ? atoi(argv[3]) : 10;
+	shot_rate = (argc >= 5) ? atof(argv[4]) : 0.0;
+	use_bot = (argc >= 6 && strcmp(argv[5], "bot") == 0);
+	if (num_clients < 1 || num_clients > LOAD_CONNECTIONS_MAX) {
+		fprintf(stderr, "Number of connections must be between 1 and %d\n",
+		        LOAD_CONNECTIONS_MAX);
+		return 1;
+	}
+	if (hostname_to_ip(argv[1], host_ip) != 0) {
+		return 1;
+	}
+	const char *cache_path = getenv(BOT_CACHE_ENV);
+	if (use_bot && bot_cache_init(cache_path) != 0) {
+		return 1;
+	}
+	// Silence the chatter of join_host
+	input_open_batch("-");
+	signal(SIGPIPE, SIG_IGN);
+
+	struct load_client *clients = calloc(num_clients, sizeof(*clients));
+	if (clients == NULL) {
+		fprintf(stderr, "Could not allocate clients\n");
+		return 1;
+	}
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, LOAD_STACK_SIZE);
+
+	printf("Playing against %s with %d connection(s) for %d s\n",
+	       host_ip, num_clients, seconds);
+	const uint64_t start = now_ns();
+	int i;
+	for (i = 0; i < num_clients; ++i) {
+		clients[i].id = i;
+		clients[i].seed = (unsigned int)(start ^ (i * 2654435761u));
+		if (pthread_create(&clients[i].thread, &attr, run_client, &clients[i]) != 0) {
+			fprintf(stderr, "Could not start client %d\n", i);
+			atomic_store(&stop, 1);
+			return 1;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	sleep(seconds);
+	// Clients finish their current game and then leave
+	atomic_store(&stop, 1);
+	for (i = 0; i < num_clients; ++i) {
+		pthread_join(clients[i].thread, NULL);
+	}
+	const double elapsed = (now_ns() - start) / 1e9;
+
+	int games = 0, shots = 0;
+	uint64_t lookups = 0, cache_hits = 0;
+	int errors[NUM_LOAD_ERRORS] = {0};
+	int k;
+	for (i = 0; i < num_clients; ++i) {
+		games += clients[i].games;
+		shots += clients[i].shots;
+		lookups += clients[i].bot.lookups;
+		cache_hits += clients[i].bot.cache_hits;
+		for (k = 0; k < NUM_LOAD_ERRORS; ++k) {
+			errors[k] += clients[i].errors[k];
+		}
+	}
+	// Both players of a match are load clients when playing on a server
+	printf("Games:     %d sides finished in %.1f s, %.1f games/s (%.1f sides/s)\n",
+	       games, elapsed, games / 2.0 / elapsed, games / elapsed);
+	printf("Shots:     %d, %.1f shots/s, %.1f per game side\n", shots, shots / elapsed,
+	       games ? (double)shots / games : 0.0);
+	if (use_bot) {
+		printf("Bot cache: %llu of %llu decisions cached\n",
+		       (unsigned long long)cache_hits, (unsigned long long)lookups);
+		if (cache_path != NULL) {
+			bot_cache_save(cache_path);
+		}
+		bot_cache_destroy();
+	}
+	print_percentiles(clients, num_clients, offsetof(struct load_client, handshake),
+	                  "Handshake:");
+	print_percentiles(clients, num_clients, offsetof(struct load_client, turn), "Turn:");
+	printf("Errors:   ");
+	for (k = 0; k < NUM_LOAD_ERRORS; ++k) {
+		printf(" %s %d", error_names[k], errors[k]);
+	}
+	printf("\n");
+	free(clients);
+	return 0;
+}
@@ -0,0 +1,117 @@
+#include "clock.h"
+#include "matchmaking.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Benchmark parameters
+#define BENCH_THREADS_MAX (64)
+#define BENCH_CHUNK (256)            // tickets a thread enqueues before pairing
+#define BENCH_FAKE_SOCKET (1 << 24)  // above any open descriptor
+
+// One benchmark thread; it queues its share of clients like an acceptor and
+// pairs like a game thread
+struct bench_thread {
+	pthread_t thread;
+	int first;  // first client of its share
+	int count;
+	long pairs;
+	long mismatches;  // pairs of players from different buckets
+};
+
+static struct matchmaker mm;
+
+// PRE: Client
+// POST: Score of the client, spread over all skill buckets
+static int client_score(const int client) {
+	return (int)((client * 2654435761u) % (SKILL_BUCKETS_MAX * SKILL_BUCKET_WIDTH));
+}
+
+// PRE: Client
+// POST: Bucket the matchmaker puts the client in
+static int client_bucket(const int client) {
+	const int bucket = client_score(client) / SKILL_BUCKET_WIDTH;
+	return (bucket < mm.num_buckets) ? bucket : mm.num_buckets - 1;
+}
+
+// PRE: Benchmark thread
+// POST: Pairs formed from the tickets available
+static void pair_all(struct bench_thread *b) {
+	struct ticket first, second;
+	while (matchmaker_pair(&mm, &first, &second)) {
+		b->pairs++;
+		b->mismatches += (client_bucket(first.record) != client_bucket(second.record));
+	}
+}
+
+// PRE: Benchmark thread with its share of clients
+// POST: All of its clients queued, pairs formed while doing so counted
+static void *run_bench(void *arg) {
+	struct bench_thread *b = arg;
+	int i = 0;
+	while (i < b->count) {
+		const int end = (i + BENCH_CHUNK < b->count) ? i + BENCH_CHUNK : b->count;
+		for (; i < end; ++i) {
+			const int client = b->first + i;
+			const struct ticket t = {BENCH_FAKE_SOCKET + client, client,
+			                         client_score(client)};
+			while (matchmaker_enqueue(&mm, &t) != 0) {
+				pair_all(b);  // bucket full, make room
+			}
+		}
+		pair_all(b);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 4) {
+		fprintf(stderr, "Usage: ./battle-match-bench [clients] [threads] [skill buckets]\n");
+		return 1;
+	}
+	const int clients = (argc >= 2) ? atoi(argv[1]) : 1000000;
+	const int threads = (argc >= 3) ? atoi(argv[2]) : 4;
+	const int buckets = (argc >= 4) ? atoi(argv[3]) : 4;
+	if (clients < 2 || threads < 1 || threads > BENCH_THREADS_MAX ||
+	    buckets < 1 || buckets > SKILL_BUCKETS_MAX) {
+		fprintf(stderr, "Need at least 2 clients, 1 to %d threads and 1 to %d buckets\n",
+		        BENCH_THREADS_MAX, SKILL_BUCKETS_MAX);
+		return 1;
+	}
+	if (matchmaker_init(&mm, buckets) != 0) {
+		fprintf(stderr, "Could not allocate matchmaker\n");
+		return 1;
+	}
+
+	struct bench_thread bench[BENCH_THREADS_MAX] = {0};
+	const uint64_t start = now_ns();
+	int i;
+	for (i = 0; i < threads; ++i) {
+		bench[i].first = (int)((long)clients * i / threads);
+		bench[i].count = (int)((long)clients * (i + 1) / threads) - bench[i].first;
+		if (pthread_create(&bench[i].thread, NULL, run_bench, &bench[i]) != 0) {
+			fprintf(stderr, "Could not start thread %d\n", i);
+			return 1;
+		}
+	}
+	for (i = 0; i < threads; ++i) {
+		pthread_join(bench[i].thread, NULL);
+	}
+	// Players the threads left waiting for each other
+	pair_all(&bench[0]);
+	long pairs = 0, mismatches = 0;
+	for (i = 0; i < threads; ++i) {
+		pairs += bench[i].pairs;
+		mismatches += bench[i].mismatches;
+	}
+	const double seconds = (now_ns() - start) / 1e9;
+
+	printf("Paired %ld of %d clients in %.3f s with %d thread(s) and %d bucket(s)\n",
+	       2 * pairs, clients, seconds, threads, buckets);
+	printf("%.0f clients paired per second, %ld pair(s) across buckets\n",
+	       2 * pairs / seconds, mismatches);
+	// At most one player per bucket is left without an opponent
+	matchmaker_destroy(&mm);
+	return (mismatches > 0 || 2 * pairs < clients - buckets);
+}